@@ -0,0 +1,415 @@
+/*
+ * bintrace.c - Compact binary memory traces for Cache Lab
+ *
+ * File layout (all integers little-endian):
+ *
+ *   header:  u32 magic, u8 version, u8 flags, u16 reserved, u64 records
+ *   blocks:  u32 raw length, u32 stored length, stored bytes
+ *
+ * A block whose stored length equals its raw length is stored as is,
+ * otherwise it is LZ compressed. Records never straddle blocks. Each
+ * record starts with a tag byte:
+ *
+ *   bits 0-1  operation (0 = I, 1 = L, 2 = S, 3 = M)
+ *   bits 2-4  log2 of the access size, or 7 when a varint size follows
+ *   bit  5    address delta repeats the previous one, no varint follows
+ *
+ * followed by the optional zigzag varint address delta and varint size.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bintrace.h"
+
+#define HEADER_SIZE 16
+#define RECORD_MAX 16       /* tag + 10-byte delta + 5-byte size */
+
+#define TAG_OP_MASK 0x3
+#define TAG_SIZE_SHIFT 2
+#define TAG_SIZE_MASK 0x7
+#define TAG_SIZE_VARINT 7
+#define TAG_REPEAT 0x20
+
+/* LZ parameters: 4-byte minimum match within a 64KB window */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+struct bintrace {
+    FILE *fp;
+    int writing;
+    int flags;
+    unsigned long long count;
+    /* delta state, one stream for instructions and one for data */
+    unsigned long long prev_address[2];
+    long long prev_delta[2];
+    /* current block */
+    unsigned char *block;
+    unsigned char *stored;
+    size_t length;
+    size_t position;
+};
+
+static const char op_letters[4] = {'I', 'L', 'S', 'M'};
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static size_t put_varint(unsigned char *p, unsigned long long v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+/* Returns 0 on a truncated or overlong varint */
+static size_t get_varint(const unsigned char *p, size_t avail,
+                         unsigned long long *v)
+{
+    unsigned long long result = 0;
+    size_t n;
+    for (n = 0; n < avail && n < 10; n++) {
+        result |= (unsigned long long)(p[n] & 0x7f) << (7 * n);
+        if (!(p[n] & 0x80)) {
+            *v = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * lz_compress - LZ77 with LZ4-style sequences: a token holding literal
+ *     and match lengths in its nibbles (15 means 255-run extension bytes
+ *     follow), the literals, then a 16-bit offset. The final sequence
+ *     has literals only. Returns 0 if the output would not fit in cap.
+ */
+static size_t lz_compress(const unsigned char *in, size_t n,
+                          unsigned char *out, size_t cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    size_t anchor = 0, i = 0, o = 0;
+
+    memset(table, 0xff, sizeof(table));
+    while (1) {
+        size_t match = 0, offset = 0;
+        while (i + LZ_MIN_MATCH <= n) {
+            uint32_t word = get_u32(in + i);
+            uint32_t h = (word * 2654435761u) >> (32 - LZ_HASH_BITS);
+            uint32_t cand = table[h];
+            table[h] = i;
+            if (cand != 0xffffffffu && i - cand <= LZ_MAX_OFFSET &&
+                get_u32(in + cand) == word) {
+                match = LZ_MIN_MATCH;
+                while (i + match < n && in[cand + match] == in[i + match])
+                    match++;
+                offset = i - cand;
+                break;
+            }
+            i++;
+        }
+        if (!match)
+            i = n;
+
+        /* emit token, literals and (unless last) the match */
+        {
+            size_t lit = i - anchor, len;
+            size_t mcode = match ? match - LZ_MIN_MATCH : 0;
+            if (o + 1 + lit / 255 + 1 + lit + 2 + mcode / 255 + 1 > cap)
+                return 0;
+            out[o++] = ((lit < 15 ? lit : 15) << 4) | (mcode < 15 ? mcode : 15);
+            if (lit >= 15) {
+                for (len = lit - 15; len >= 255; len -= 255)
+                    out[o++] = 255;
+                out[o++] = len;
+            }
+            memcpy(out + o, in + anchor, lit);
+            o += lit;
+            if (!match)
+                return o;
+            out[o++] = offset;
+            out[o++] = offset >> 8;
+            if (mcode >= 15) {
+                for (len = mcode - 15; len >= 255; len -= 255)
+                    out[o++] = 255;
+                out[o++] = len;
+            }
+            i += match;
+            anchor = i;
+        }
+    }
+}
+
+/* lz_decompress - Returns 0 unless exactly n bytes were produced */
+static int lz_decompress(const unsigned char *in, size_t stored,
+                         unsigned char *out, size_t n)
+{
+    size_t i = 0, o = 0;
+
+    while (i < stored) {
+        unsigned token = in[i++];
+        size_t lit = token >> 4, match = token & 0xf, offset;
+        if (lit == 15) {
+            do {
+                if (i >= stored)
+                    return 0;
+                lit += in[i];
+            } while (in[i++] == 255);
+        }
+        if (lit > stored - i || lit > n - o)
+            return 0;
+        memcpy(out + o, in + i, lit);
+        i += lit;
+        o += lit;
+        if (o == n)
+            return i == stored;
+        if (i + 2 > stored)
+            return 0;
+        offset = in[i] | (in[i + 1] << 8);
+        i += 2;
+        if (match == 15) {
+            do {
+                if (i >= stored)
+                    return 0;
+                match += in[i];
+            } while (in[i++] == 255);
+        }
+        match += LZ_MIN_MATCH;
+        if (offset == 0 || offset > o || match > n - o)
+            return 0;
+        while (match--) {
+            out[o] = out[o - offset];
+            o++;
+        }
+    }
+    return 0;
+}
+
+static bintrace_t *bintrace_alloc(FILE *fp, int writing, int flags)
+{
+    bintrace_t *trace = calloc(1, sizeof(bintrace_t));
+    if (trace == NULL)
+        return NULL;
+    trace->block = malloc(BINTRACE_BLOCK_SIZE);
+    trace->stored = malloc(BINTRACE_BLOCK_SIZE);
+    if (trace->block == NULL || trace->stored == NULL) {
+        free(trace->block);
+        free(trace->stored);
+        free(trace);
+        return NULL;
+    }
+    trace->fp = fp;
+    trace->writing = writing;
+    trace->flags = flags;
+    return trace;
+}
+
+static void write_header(bintrace_t *trace)
+{
+    unsigned char header[HEADER_SIZE] = {0};
+    put_u32(header, BINTRACE_MAGIC);
+    header[4] = BINTRACE_VERSION;
+    header[5] = trace->flags;
+    put_u32(header + 8, (uint32_t)trace->count);
+    put_u32(header + 12, (uint32_t)(trace->count >> 32));
+    fwrite(header, 1, HEADER_SIZE, trace->fp);
+}
+
+bintrace_t *bintrace_open_read(FILE *fp)
+{
+    unsigned char header[HEADER_SIZE];
+    bintrace_t *trace;
+
+    if (fread(header, 1, HEADER_SIZE, fp) != HEADER_SIZE ||
+        get_u32(header) != BINTRACE_MAGIC ||
+        header[4] != BINTRACE_VERSION ||
+        (trace = bintrace_alloc(fp, 0, header[5])) == NULL) {
+        rewind(fp);
+        return NULL;
+    }
+    return trace;
+}
+
+bintrace_t *bintrace_open_write(FILE *fp, int flags)
+{
+    bintrace_t *trace = bintrace_alloc(fp, 1, flags);
+    if (trace != NULL)
+        write_header(trace);
+    return trace;
+}
+
+static void flush_block(bintrace_t *trace)
+{
+    unsigned char frame[8];
+    size_t stored = 0;
+
+    if (trace->length == 0)
+        return;
+    if (trace->flags & BINTRACE_FLAG_LZ)
+        stored = lz_compress(trace->block, trace->length,
+                             trace->stored, trace->length - 1);
+    put_u32(frame, trace->length);
+    put_u32(frame + 4, stored ? stored : trace->length);
+    fwrite(frame, 1, sizeof(frame), trace->fp);
+    if (stored)
+        fwrite(trace->stored, 1, stored, trace->fp);
+    else
+        fwrite(trace->block, 1, trace->length, trace->fp);
+    trace->length = 0;
+}
+
+/* Returns 0 at end of trace or on a malformed block */
+static int load_block(bintrace_t *trace)
+{
+    unsigned char frame[8];
+    size_t raw, stored;
+
+    if (fread(frame, 1, sizeof(frame), trace->fp) != sizeof(frame))
+        return 0;
+    raw = get_u32(frame);
+    stored = get_u32(frame + 4);
+    if (raw == 0 || raw > BINTRACE_BLOCK_SIZE || stored > raw)
+        return 0;
+    if (stored == raw) {
+        if (fread(trace->block, 1, raw, trace->fp) != raw)
+            return 0;
+    } else {
+        if (fread(trace->stored, 1, stored, trace->fp) != stored ||
+            !lz_decompress(trace->stored, stored, trace->block, raw))
+            return 0;
+    }
+    trace->length = raw;
+    trace->position = 0;
+    return 1;
+}
+
+void bintrace_write(bintrace_t *trace, const bintrace_record_t *record)
+{
+    unsigned char *p;
+    int stream = record->op != 'I';
+    int code, size_code = TAG_SIZE_VARINT;
+    long long delta;
+
+    if (trace->length + RECORD_MAX > BINTRACE_BLOCK_SIZE)
+        flush_block(trace);
+    p = trace->block + trace->length;
+
+    for (code = 0; code < 4 && op_letters[code] != record->op; code++)
+        ;
+    code &= TAG_OP_MASK;
+    if (record->size && !(record->size & (record->size - 1))) {
+        for (size_code = 0; (1u << size_code) != record->size; size_code++)
+            ;
+        if (size_code >= TAG_SIZE_VARINT)
+            size_code = TAG_SIZE_VARINT;
+    }
+
+    delta = (long long)(record->address - trace->prev_address[stream]);
+    trace->prev_address[stream] = record->address;
+    if (delta == trace->prev_delta[stream]) {
+        *p++ = code | (size_code << TAG_SIZE_SHIFT) | TAG_REPEAT;
+    } else {
+        *p++ = code | (size_code << TAG_SIZE_SHIFT);
+        p += put_varint(p, ((unsigned long long)delta << 1) ^ (delta >> 63));
+        trace->prev_delta[stream] = delta;
+    }
+    if (size_code == TAG_SIZE_VARINT)
+        p += put_varint(p, record->size);
+
+    trace->length = p - trace->block;
+    trace->count++;
+}
+
+int bintrace_read(bintrace_t *trace, bintrace_record_t *record)
+{
+    const unsigned char *p;
+    size_t avail, n;
+    unsigned tag;
+    int stream;
+    unsigned long long value;
+
+    if (trace->position == trace->length && !load_block(trace))
+        return 0;
+    p = trace->block + trace->position;
+    avail = trace->length - trace->position;
+
+    tag = *p++;
+    avail--;
+    record->op = op_letters[tag & TAG_OP_MASK];
+    stream = record->op != 'I';
+    if (!(tag & TAG_REPEAT)) {
+        if ((n = get_varint(p, avail, &value)) == 0)
+            return 0;
+        p += n;
+        avail -= n;
+        trace->prev_delta[stream] = (long long)(value >> 1) ^ -(long long)(value & 1);
+    }
+    trace->prev_address[stream] += trace->prev_delta[stream];
+    record->address = trace->prev_address[stream];
+    if (((tag >> TAG_SIZE_SHIFT) & TAG_SIZE_MASK) == TAG_SIZE_VARINT) {
+        if ((n = get_varint(p, avail, &value)) == 0)
+            return 0;
+        p += n;
+        record->size = value;
+    } else {
+        record->size = 1u << ((tag >> TAG_SIZE_SHIFT) & TAG_SIZE_MASK);
+    }
+
+    trace->position = p - trace->block;
+    trace->count++;
+    return 1;
+}
+
+void bintrace_close(bintrace_t *trace)
+{
+    if (trace->writing) {
+        long end;
+        flush_block(trace);
+        /* patch the record count into the header when fp is seekable */
+        end = ftell(trace->fp);
+        if (end >= 0 && fseek(trace->fp, 0, SEEK_SET) == 0) {
+            write_header(trace);
+            fseek(trace->fp, end, SEEK_SET);
+        }
+        fflush(trace->fp);
+    }
+    free(trace->block);
+    free(trace->stored);
+    free(trace);
+}
+
+unsigned long long bintrace_count(const bintrace_t *trace)
+{
+    return trace->count;
+}
+
+int bintrace_parse_text(const char *line, bintrace_record_t *record)
+{
+    if (line[0] == 'I' && line[1] == ' ')
+        record->op = 'I';
+    else if (line[0] == ' ' && line[2] == ' ' &&
+             (line[1] == 'L' || line[1] == 'S' || line[1] == 'M'))
+        record->op = line[1];
+    else
+        return 0;
+    return sscanf(line + 3, "%llx,%u", &record->address, &record->size) == 2;
+}
+
+void bintrace_print_text(FILE *fp, const bintrace_record_t *record)
+{
+    if (record->op == 'I')
+        fprintf(fp, "I  %08llx,%u\n", record->address, record->size);
+    else
+        fprintf(fp, " %c %08llx,%u\n", record->op, record->address, record->size);
+}
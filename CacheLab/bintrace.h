@@ -0,0 +1,68 @@
+/*
+ * bintrace.h - Compact binary memory traces for Cache Lab
+ *
+ * A binary trace holds the same records as a valgrind lackey trace
+ * (" L 0400d7d4,8") in a few bytes each: a tag byte packing the
+ * operation and a size code, followed by the zigzag varint delta from
+ * the previous address of the same kind (instruction or data), or
+ * nothing at all when the delta repeats. Records are grouped in blocks
+ * that are optionally LZ compressed.
+ */
+
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include <stdio.h>
+
+/* "CSTR" in little-endian byte order */
+#define BINTRACE_MAGIC 0x52545343u
+#define BINTRACE_VERSION 1
+
+/* Header flags */
+#define BINTRACE_FLAG_LZ 0x1
+
+/* Uncompressed size of one block of records */
+#define BINTRACE_BLOCK_SIZE (1 << 16)
+
+typedef struct bintrace_record {
+    char op;                    /* 'I', 'L', 'S' or 'M', as in lackey */
+    unsigned long long address;
+    unsigned int size;
+} bintrace_record_t;
+
+typedef struct bintrace bintrace_t;
+
+/*
+ * bintrace_open_read - Start reading a binary trace from fp. Returns
+ *     NULL, with fp rewound, when fp does not hold a binary trace.
+ */
+bintrace_t *bintrace_open_read(FILE *fp);
+
+/* bintrace_open_write - Start writing a binary trace to fp */
+bintrace_t *bintrace_open_write(FILE *fp, int flags);
+
+/* bintrace_read - Read the next record; returns 0 at end of trace */
+int bintrace_read(bintrace_t *trace, bintrace_record_t *record);
+
+/* bintrace_write - Append one record to the trace */
+void bintrace_write(bintrace_t *trace, const bintrace_record_t *record);
+
+/*
+ * bintrace_close - Flush pending records and release the trace. The
+ *     underlying FILE is left open for the caller.
+ */
+void bintrace_close(bintrace_t *trace);
+
+/* bintrace_count - Number of records read or written so far */
+unsigned long long bintrace_count(const bintrace_t *trace);
+
+/*
+ * bintrace_parse_text - Parse one line of a lackey text trace. Returns
+ *     1 if the line is an access record, 0 for any other line.
+ */
+int bintrace_parse_text(const char *line, bintrace_record_t *record);
+
+/* bintrace_print_text - Print a record as a lackey text trace line */
+void bintrace_print_text(FILE *fp, const bintrace_record_t *record);
+
+#endif /* BINTRACE_H */
@@ -1,5 +1,6 @@
 /* include necessary headers */
 #include "cachelab.h"
+#include "csim.h"
 
 #include "getopt.h"
 #include "stdlib.h"
@@ -11,91 +12,121 @@
 
 #include "stdint.h"
 
-/* cache struct definition */
-typedef struct CSim_Cache_Entry {
-    char valid_bit;
-    uint64_t tag_bit;
-}CSim_Cache_Entry;
-
-typedef struct CSim_Cache_Set{
-    CSim_Cache_Entry * entries;
-}CSim_Cache_Set;
-
-typedef struct CSim_Cache {
-    /* basic arguments */
-    int block_offset;
-    int set_number;
-    int line_number;
-    /* masks and offsets */
-    int tag_offset;
-    int set_offset;
-    uint64_t tag_mask;
-    uint64_t set_mask;
-    /* cache */
-    CSim_Cache_Set * sets;
-}CSim_Cache;
-
-/* simulation result definition */
-typedef struct CSim_Cache_Result {
-    int hit;
-    int miss;
-    int evict;
-}CSim_Cache_Result;
-
-/* operation type definition */
-typedef enum CSIM_OPERATION_TYPE {
-    CSIM_OPERATION_TYPE_NONE,
-    CSIM_OPERATION_TYPE_MODIFY,
-    CSIM_OPERATION_TYPE_LOAD,
-    CSIM_OPERATION_TYPE_STORE,
-}CSIM_OPERATION_TYPE;
-
-/* operation result definition */
-typedef enum CSIM_OPERATION_RESULT {
-    CSIM_OPERATION_RESULT_MISS,
-    CSIM_OPERATION_RESULT_HIT,
-    CSIM_OPERATION_RESULT_MISS_EVICTION,
-}CSIM_OPERATION_RESULT;
-
-/* error definition */
-typedef enum CSIM_ERROR {
-    CSIM_OK = 0,
-    CSIM_ERROR_INVALID_OPTION,
-    CSIM_ERROR_MISSING_ARGUMENT,
-    CSIM_ERROR_FILE_CANNOT_OPEN,
-    CSIM_ERROR_OUT_OF_MEMORY,
-}CSIM_ERROR;
-
-/* macro definition for get a value given mask and offset */
-#define csim_get_value(number, mask, offset) (((number) & (mask)) >> (offset))
+#include "math.h"
+
+/* z value of a two-sided 95% confidence interval, used past 30 units */
+#define CSIM_SAMPLING_Z 1.96
+
+/* Two-sided 95% quantiles of Student's t by degrees of freedom, for few units */
+static const double csim_sampling_t[] = {
+    0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+/* RRIP parameters: 2-bit RRPV, BRRIP inserts with a long interval once every 32 fills */
+#define CSIM_RRPV_MAX 3
+#define CSIM_BRRIP_EPSILON 32
+
+/* prefetcher defaults: blocks ahead, stream buffer depth, and the page the stride table falls back to */
+#define CSIM_PREFETCH_DEGREE 1
+#define CSIM_STREAM_DEPTH 4
+#define CSIM_PAGE_BITS 12
 
 /* function list */
 /* message print functions */
 void csim_print_help_info();
 void csim_error_missing_argument();
+void csim_error_invalid_policy(const char * name);
+void csim_error_invalid_prefetcher(const char * name);
 void csim_error_file_cannot_open();
 void csim_error_out_of_memory();
-/* cache structure related functions */
-CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_offset);
-void csim_deconstruct_cache(CSim_Cache ** pcache);
-/* cache simulation function */
-CSim_Cache_Result csim_parse_trace_file(CSim_Cache * cache, FILE * file_pointer, char verbose_flag);
+/* replacement policy functions */
+uint64_t csim_random(CSim_Cache * cache);
+void csim_policy_lru_hit(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+void csim_policy_lru_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+int csim_policy_lru_victim(CSim_Cache * cache, CSim_Cache_Set * set);
+void csim_policy_none_hit(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+void csim_policy_none_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+int csim_policy_random_victim(CSim_Cache * cache, CSim_Cache_Set * set);
+void csim_policy_plru_touch(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+int csim_policy_plru_victim(CSim_Cache * cache, CSim_Cache_Set * set);
+void csim_policy_rrip_hit(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+void csim_policy_srrip_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+void csim_policy_brrip_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+int csim_policy_rrip_victim(CSim_Cache * cache, CSim_Cache_Set * set);
+void csim_policy_opt_touch(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+int csim_policy_opt_victim(CSim_Cache * cache, CSim_Cache_Set * set);
+const CSim_Access * csim_next_access(CSim_Trace * trace, CSim_Access * accesses, size_t count, size_t * pposition, CSim_Access * current);
+
+/* running sums over sampled sets or windows: n units of a references with m misses */
+typedef struct CSim_Sample_Sums {
+    double n, a, m, aa, mm, am;
+}CSim_Sample_Sums;
 
-/* global variable */
-char * program_name = NULL;
+/* global variable, names the program in error messages */
+char * program_name = "csim";
+
+/* replacement policy table, indexed by CSIM_POLICY_TYPE */
+const CSim_Cache_Policy csim_policies[CSIM_POLICY_TYPE_COUNT] = {
+    [CSIM_POLICY_TYPE_LRU] = {"lru", 0, csim_policy_lru_hit, csim_policy_lru_fill, csim_policy_lru_victim},
+    [CSIM_POLICY_TYPE_FIFO] = {"fifo", 0, csim_policy_none_hit, csim_policy_lru_fill, csim_policy_lru_victim},
+    [CSIM_POLICY_TYPE_RANDOM] = {"random", 0, csim_policy_none_hit, csim_policy_none_fill, csim_policy_random_victim},
+    [CSIM_POLICY_TYPE_PLRU] = {"plru", 0, csim_policy_plru_touch, csim_policy_plru_touch, csim_policy_plru_victim},
+    [CSIM_POLICY_TYPE_SRRIP] = {"srrip", 0, csim_policy_rrip_hit, csim_policy_srrip_fill, csim_policy_rrip_victim},
+    [CSIM_POLICY_TYPE_BRRIP] = {"brrip", 0, csim_policy_rrip_hit, csim_policy_brrip_fill, csim_policy_rrip_victim},
+    [CSIM_POLICY_TYPE_OPT] = {"opt", 1, csim_policy_opt_touch, csim_policy_opt_touch, csim_policy_opt_victim},
+};
+
+/* coherence protocol names, indexed by CSIM_PROTOCOL_TYPE */
+static const char * const csim_protocol_names[CSIM_PROTOCOL_TYPE_COUNT] = {
+    [CSIM_PROTOCOL_TYPE_MESI] = "mesi",
+    [CSIM_PROTOCOL_TYPE_MOESI] = "moesi",
+};
+
+/* prefetcher names, indexed by CSIM_PREFETCH_TYPE */
+static const char * const csim_prefetch_names[CSIM_PREFETCH_TYPE_COUNT] = {
+    [CSIM_PREFETCH_TYPE_NONE] = "none",
+    [CSIM_PREFETCH_TYPE_NEXT] = "next",
+    [CSIM_PREFETCH_TYPE_STRIDE] = "stride",
+    [CSIM_PREFETCH_TYPE_STREAM] = "stream",
+};
 
 void csim_print_help_info() {
-    printf("Usage: ./csim [-hv] -s <num> -E <num> -b <num> -t <file>\n");
+    printf("Usage: ./csim [-hvx] -s <num> -E <num> -b <num> [-p <policy>] -t <file>\n");
     printf("Options:\n");
     printf("  -h         Print this help message.\n");
     printf("  -v         Optional verbose flag.\n");
     printf("  -s <num>   Number of set index bits.\n");
     printf("  -E <num>   Number of lines per set.\n");
     printf("  -b <num>   Number of block offset bits.\n");
-    printf("  -t <file>  Trace file.\n\n");
+    printf("  -p <name>  Replacement policy: lru (default), fifo, random,\n");
+    printf("             plru, srrip, brrip or opt.\n");
+    printf("  -t <file>  Trace file, lackey text or binary (see trace2bin).\n");
+    printf("  -x         Split accesses that straddle blocks into one per block.\n");
+    printf("  -S <num>   Simulate only one set in <num> and extrapolate.\n");
+    printf("  -W <period>:<warmup>:<window>\n");
+    printf("             Of every <period> accesses, simulate <warmup> without\n");
+    printf("             counting them, count the next <window> and skip the rest.\n");
+    printf("  -c         With -S or -W, also simulate the whole trace to compare.\n");
+    printf("  -P <name>[:<degree>[:<latency>]]\n");
+    printf("             Hardware prefetcher: next (next <degree> lines), stride\n");
+    printf("             (per instruction, or per page without one) or stream\n");
+    printf("             (buffers <degree> blocks deep). Prefetches arrive\n");
+    printf("             <latency> accesses after they are issued (default 0).\n");
+    printf("  -n <num>   Simulate <num> cores, each with its own cache, kept\n");
+    printf("             coherent over a shared last-level cache. The thread id\n");
+    printf("             after the size of each trace line picks the core.\n");
+    printf("  -m <name>  Coherence protocol with -n: mesi (default) or moesi.\n");
+    printf("  -L <s>:<E> Set index bits and lines per set of the last-level\n");
+    printf("             cache (default s+3 and E).\n\n");
     printf("Examples:\n");
     printf("  linux>  ./csim -s 4 -E 1 -b 4 -t traces/yi.trace\n");
     printf("  linux>  ./csim -v -s 8 -E 2 -b 4 -t traces/yi.trace\n");
+    printf("  linux>  ./csim -s 4 -E 4 -b 4 -p plru -t traces/yi.trace\n");
+    printf("  linux>  ./csim -s 8 -E 2 -b 4 -S 16 -c -t traces/long.trace\n");
+    printf("  linux>  ./csim -s 8 -E 2 -b 4 -P stride:2:16 -t traces/long.trace\n");
+    printf("  linux>  ./csim -s 5 -E 2 -b 6 -n 4 -m moesi -t threads.trace\n");
 }
 
 void csim_error_missing_argument() {
@@ -103,6 +134,16 @@ void csim_error_missing_argument() {
     csim_print_help_info();
 }
 
+void csim_error_invalid_policy(const char * name) {
+    printf("%s: Unknown replacement policy '%s'\n", program_name, name);
+    csim_print_help_info();
+}
+
+void csim_error_invalid_prefetcher(const char * name) {
+    printf("%s: Invalid prefetcher '%s'\n", program_name, name);
+    csim_print_help_info();
+}
+
 void csim_error_file_cannot_open() {
     printf("%s: No such file or directory\n", program_name);
 }
@@ -111,7 +152,133 @@ void csim_error_out_of_memory() {
     printf("%s: Out of memory\n", program_name);
 }
 
-CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_offset) {
+/* xorshift64, so that random policies are reproducible from run to run */
+uint64_t csim_random(CSim_Cache * cache) {
+    uint64_t x = cache->random_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    cache->random_state = x;
+    return x;
+}
+
+/* LRU: stamp on every use, evict the oldest stamp */
+void csim_policy_lru_hit(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    set->entries[index].stamp = cache->clock;
+}
+
+/* FIFO shares the victim selection of LRU but stamps only on fill */
+void csim_policy_lru_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    set->entries[index].stamp = cache->clock;
+}
+
+int csim_policy_lru_victim(CSim_Cache * cache, CSim_Cache_Set * set) {
+    int victim = 0;
+    for (int index = 1 ; index < cache->line_number ; ++index) {
+        if (set->entries[index].stamp < set->entries[victim].stamp) {
+            victim = index;
+        }
+    }
+    return victim;
+}
+
+void csim_policy_none_hit(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+}
+
+void csim_policy_none_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+}
+
+int csim_policy_random_victim(CSim_Cache * cache, CSim_Cache_Set * set) {
+    return (int)(csim_random(cache) % (uint64_t)cache->line_number);
+}
+
+/*
+ * Tree-PLRU over plru_leaves (E rounded up to a power of two) leaves.
+ * Node n has children 2n and 2n+1; a bit of 0 means the victim is on
+ * the left. Touching a line points every node on its path away from it.
+ */
+void csim_policy_plru_touch(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    int node = index + cache->plru_leaves;
+    while (node > 1) {
+        set->plru_bits[node >> 1] = !(node & 1);
+        node >>= 1;
+    }
+}
+
+int csim_policy_plru_victim(CSim_Cache * cache, CSim_Cache_Set * set) {
+    int node = 1;
+    while (node < cache->plru_leaves) {
+        int child = (node << 1) | set->plru_bits[node];
+        /* skip subtrees that only hold padding leaves when E is not a power of two */
+        int leftmost = child;
+        while (leftmost < cache->plru_leaves) {
+            leftmost <<= 1;
+        }
+        if (leftmost - cache->plru_leaves >= cache->line_number) {
+            child ^= 1;
+        }
+        node = child;
+    }
+    return node - cache->plru_leaves;
+}
+
+/* RRIP: hits predict near-immediate re-reference */
+void csim_policy_rrip_hit(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    set->entries[index].rrpv = 0;
+}
+
+/* SRRIP inserts with a long re-reference interval */
+void csim_policy_srrip_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    set->entries[index].rrpv = CSIM_RRPV_MAX - 1;
+}
+
+/* BRRIP inserts with a distant interval, and occasionally a long one */
+void csim_policy_brrip_fill(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    if (csim_random(cache) % CSIM_BRRIP_EPSILON == 0) {
+        set->entries[index].rrpv = CSIM_RRPV_MAX - 1;
+    } else {
+        set->entries[index].rrpv = CSIM_RRPV_MAX;
+    }
+}
+
+int csim_policy_rrip_victim(CSim_Cache * cache, CSim_Cache_Set * set) {
+    while (1) {
+        for (int index = 0 ; index < cache->line_number ; ++index) {
+            if (set->entries[index].rrpv >= CSIM_RRPV_MAX) {
+                return index;
+            }
+        }
+        for (int index = 0 ; index < cache->line_number ; ++index) {
+            set->entries[index].rrpv++;
+        }
+    }
+}
+
+/* Belady's OPT: evict the line whose next reference is furthest away */
+void csim_policy_opt_touch(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access) {
+    set->entries[index].next_use = access->next_use;
+}
+
+int csim_policy_opt_victim(CSim_Cache * cache, CSim_Cache_Set * set) {
+    int victim = 0;
+    for (int index = 1 ; index < cache->line_number ; ++index) {
+        if (set->entries[index].next_use > set->entries[victim].next_use) {
+            victim = index;
+        }
+    }
+    return victim;
+}
+
+const CSim_Cache_Policy * csim_find_policy(const char * name) {
+    for (int index = 0 ; index < CSIM_POLICY_TYPE_COUNT ; ++index) {
+        if (strcmp(csim_policies[index].name, name) == 0) {
+            return &csim_policies[index];
+        }
+    }
+    return NULL;
+}
+
+CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_offset, const CSim_Cache_Policy * policy) {
     /* memory allocation */
     CSim_Cache * cache = malloc(sizeof(CSim_Cache));
     if (cache == NULL) {
@@ -127,6 +294,15 @@ CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_off
     cache->tag_offset = block_offset + set_number;
     cache->set_mask = ((((((uint64_t)0xFFFFFFFFFFFFFFFF) << (64 - cache->tag_offset)) >> (64 - cache->tag_offset)) >> block_offset) << block_offset);
     cache->set_offset = block_offset;
+    /* configure replacement policy */
+    cache->policy = policy;
+    cache->plru_leaves = 1;
+    while (cache->plru_leaves < line_number) {
+        cache->plru_leaves <<= 1;
+    }
+    cache->clock = 0;
+    cache->random_state = 0x9E3779B97F4A7C15ULL;
+    cache->prefetcher = NULL;
     /* memory allocation for cache */
     cache->sets = calloc((1 << set_number), sizeof(CSim_Cache_Set));
     if (cache->sets == NULL) {
@@ -135,7 +311,8 @@ CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_off
     }
     for (int index = 0 ; index < (1 << set_number) ; ++index) {
         (cache->sets)[index].entries = calloc(line_number, sizeof(CSim_Cache_Entry));
-        if ((cache->sets)[index].entries == NULL) {
+        (cache->sets)[index].plru_bits = calloc(cache->plru_leaves, sizeof(unsigned char));
+        if ((cache->sets)[index].entries == NULL || (cache->sets)[index].plru_bits == NULL) {
             csim_error_out_of_memory();
             exit(CSIM_ERROR_OUT_OF_MEMORY);
         }
@@ -146,149 +323,1149 @@ CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_off
 void csim_deconstruct_cache(CSim_Cache ** pcache) {
     /* release cache according to construct function */
     CSim_Cache * temp = *pcache;
-    int set_number = temp->set_number;
-    for (int index = 0 ; index < set_number ; ++index) {
+    int set_count = 1 << temp->set_number;
+    for (int index = 0 ; index < set_count ; ++index) {
         free((temp->sets)[index].entries);
+        free((temp->sets)[index].plru_bits);
     }
     free(temp->sets);
+    free(temp->prefetcher);
     free(temp);
     *pcache = NULL;
 }
 
-CSim_Cache_Result csim_parse_trace_file(CSim_Cache * cache, FILE * file_pointer, char verbose_flag) {
-    /* file I/O related */
+int csim_count_dirty(CSim_Cache * cache) {
+    int count = 0;
+    for (int set = 0 ; set < (1 << cache->set_number) ; ++set) {
+        for (int index = 0 ; index < cache->line_number ; ++index) {
+            CSim_Cache_Entry * pentry = &(cache->sets)[set].entries[index];
+            count += pentry->valid_bit && pentry->dirty_bit;
+        }
+    }
+    return count;
+}
+
+/*
+ * With splitting on, cut an access that runs past the end of its block
+ * down to that block and keep the rest in the trace for the next read.
+ */
+static void csim_split_access(CSim_Trace * trace, CSim_Access * access) {
+    uint64_t block_end;
+    if (trace->split_offset <= 0 || access->size <= 0) {
+        return;
+    }
+    block_end = ((access->address >> trace->split_offset) + 1) << trace->split_offset;
+    if (access->address + access->size <= block_end) {
+        return;
+    }
+    trace->rest = *access;
+    trace->rest.address = block_end;
+    trace->rest.size = access->address + access->size - block_end;
+    access->size = block_end - access->address;
+}
+
+/* read the next data access from a trace, skipping instruction loads */
+int csim_read_access(CSim_Trace * trace, CSim_Access * access) {
     char line[80];
-    char * line_pointer = NULL;
-    /* cache type and cache result */
-    CSIM_OPERATION_TYPE type;
-    CSIM_OPERATION_RESULT result;
-    /* address and set index & tag bis from it */
-    int address = 0;
-    int set = 0, tag = 0;
-    /* line number */
-    int line_number = cache->line_number;
-    /* simulation result */
-    CSim_Cache_Result summary = {0, 0, 0};
-    /* parsing process */
-    while (fgets(line, 80, file_pointer), feof(file_pointer) == 0) {
-        line_pointer = line;
-        type = CSIM_OPERATION_TYPE_NONE;
-        /* exclude instrction load */
-        if (*line_pointer++ == ' ') {
-            switch(*line_pointer++) {
-                case 'L':
-                    type = CSIM_OPERATION_TYPE_LOAD;
-                    if (verbose_flag) {
-                        putchar('L');
-                    }
-                    break;
-                case 'S':
-                    type = CSIM_OPERATION_TYPE_STORE;
-                    if (verbose_flag) {
-                        putchar('S');
-                    }
-                    break;
-                case 'M':
-                    type = CSIM_OPERATION_TYPE_MODIFY;
-                    if (verbose_flag) {
-                        putchar('M');
-                    }
-                    break;
-                default:
-                    type = CSIM_OPERATION_TYPE_NONE;
-                    break;
+    unsigned long long address;
+    if (trace->rest.size > 0) {
+        *access = trace->rest;
+        trace->rest.size = 0;
+        csim_split_access(trace, access);
+        return 1;
+    }
+    if (trace->binary != NULL) {
+        bintrace_record_t record;
+        while (bintrace_read(trace->binary, &record)) {
+            if (record.op == 'I') {
+                trace->pc = record.address;
+                continue;
             }
-            result = CSIM_OPERATION_RESULT_MISS_EVICTION;
-            sscanf(line_pointer, "%x", &address);
+            access->type = record.op == 'L' ? CSIM_OPERATION_TYPE_LOAD :
+                           record.op == 'S' ? CSIM_OPERATION_TYPE_STORE :
+                           CSIM_OPERATION_TYPE_MODIFY;
+            access->address = record.address;
+            access->size = record.size;
+            access->next_use = CSIM_NEVER;
+            access->pc = trace->pc;
+            access->thread = 0;
+            csim_split_access(trace, access);
+            return 1;
+        }
+        return 0;
+    }
+    while (fgets(line, 80, trace->file_pointer) != NULL) {
+        if (line[0] == 'I') {
+            unsigned long long pc = 0;
+            sscanf(line + 1, "%llx", &pc);
+            trace->pc = pc;
+        }
+        if (line[0] != ' ') {
+            continue;
+        }
+        switch(line[1]) {
+            case 'L':
+                access->type = CSIM_OPERATION_TYPE_LOAD;
+                break;
+            case 'S':
+                access->type = CSIM_OPERATION_TYPE_STORE;
+                break;
+            case 'M':
+                access->type = CSIM_OPERATION_TYPE_MODIFY;
+                break;
+            default:
+                access->type = CSIM_OPERATION_TYPE_NONE;
+                break;
+        }
+        address = 0;
+        access->size = 0;
+        access->thread = 0;
+        /* an optional thread id follows the size in multi-threaded traces */
+        sscanf(line + 2, "%llx,%d %d", &address, &access->size, &access->thread);
+        if (access->thread < 0) {
+            access->thread = 0;
+        }
+        access->address = address;
+        access->next_use = CSIM_NEVER;
+        access->pc = trace->pc;
+        csim_split_access(trace, access);
+        return 1;
+    }
+    return 0;
+}
+
+/* read the whole trace into memory, for policies that look ahead */
+CSim_Access * csim_load_trace(CSim_Trace * trace, size_t * pcount) {
+    size_t count = 0, capacity = 1024;
+    CSim_Access * accesses = malloc(capacity * sizeof(CSim_Access));
+    if (accesses == NULL) {
+        csim_error_out_of_memory();
+        exit(CSIM_ERROR_OUT_OF_MEMORY);
+    }
+    while (csim_read_access(trace, &accesses[count])) {
+        if (++count == capacity) {
+            capacity <<= 1;
+            accesses = realloc(accesses, capacity * sizeof(CSim_Access));
+            if (accesses == NULL) {
+                csim_error_out_of_memory();
+                exit(CSIM_ERROR_OUT_OF_MEMORY);
+            }
+        }
+    }
+    *pcount = count;
+    return accesses;
+}
+
+/*
+ * Fill next_use of every access with the position of the next access to
+ * the same block, walking the trace backwards with an open-addressing
+ * table from block number to the latest position seen.
+ */
+void csim_build_next_use(CSim_Cache * cache, CSim_Access * accesses, size_t count) {
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity <<= 1;
+    }
+    uint64_t * blocks = malloc(capacity * sizeof(uint64_t));
+    uint64_t * positions = malloc(capacity * sizeof(uint64_t));
+    if (blocks == NULL || positions == NULL) {
+        csim_error_out_of_memory();
+        exit(CSIM_ERROR_OUT_OF_MEMORY);
+    }
+    for (size_t index = 0 ; index < capacity ; ++index) {
+        positions[index] = CSIM_NEVER;
+    }
+    for (size_t index = count ; index-- > 0 ; ) {
+        uint64_t block = accesses[index].address >> cache->block_offset;
+        size_t slot = (size_t)((block * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+        while (positions[slot] != CSIM_NEVER && blocks[slot] != block) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        accesses[index].next_use = positions[slot];
+        blocks[slot] = block;
+        positions[slot] = index;
+    }
+    free(blocks);
+    free(positions);
+}
+
+CSIM_PREFETCH_TYPE csim_find_prefetcher(const char * name) {
+    for (int index = 0 ; index < CSIM_PREFETCH_TYPE_COUNT ; ++index) {
+        if (strcmp(csim_prefetch_names[index], name) == 0) {
+            return index;
+        }
+    }
+    return CSIM_PREFETCH_TYPE_COUNT;
+}
+
+/* give the cache a prefetcher; a degree of 0 picks the default of its type */
+void csim_attach_prefetcher(CSim_Cache * cache, CSIM_PREFETCH_TYPE type, int degree, int latency) {
+    free(cache->prefetcher);
+    cache->prefetcher = NULL;
+    if (type == CSIM_PREFETCH_TYPE_NONE) {
+        return;
+    }
+    cache->prefetcher = calloc(1, sizeof(CSim_Prefetcher));
+    if (cache->prefetcher == NULL) {
+        csim_error_out_of_memory();
+        exit(CSIM_ERROR_OUT_OF_MEMORY);
+    }
+    if (degree == 0) {
+        degree = type == CSIM_PREFETCH_TYPE_STREAM ? CSIM_STREAM_DEPTH : CSIM_PREFETCH_DEGREE;
+    }
+    cache->prefetcher->type = type;
+    cache->prefetcher->degree = degree;
+    cache->prefetcher->latency = latency;
+}
+
+static uint64_t csim_block_of(CSim_Cache * cache, uint64_t address) {
+    return address >> cache->block_offset;
+}
+
+/* slot of the pollution filter for the line (set, tag) */
+static CSim_Pollution_Entry * csim_pollution_slot(CSim_Prefetcher * prefetcher, int set, uint64_t tag) {
+    uint64_t key = (tag ^ ((uint64_t)set << 32)) * 0x9E3779B97F4A7C15ULL;
+    return &prefetcher->pollution[(key >> 32) & (CSIM_POLLUTION_ENTRIES - 1)];
+}
+
+/* a prefetched line is used for the first time */
+static void csim_prefetch_used(CSim_Cache * cache, CSim_Cache_Entry * pentry) {
+    cache->prefetcher->result.useful++;
+    if (cache->clock < pentry->ready) {
+        cache->prefetcher->result.late++;
+    }
+    pentry->prefetched = 0;
+}
+
+/*
+ * Bring a block into the cache ahead of demand. Blocks already present
+ * are left alone; a line evicted for the prefetch counts as an eviction
+ * like any other, and is remembered so that the demand miss it may cause
+ * counts as pollution.
+ */
+static void csim_prefetch_fill(CSim_Cache * cache, uint64_t block, CSim_Cache_Result * summary) {
+    CSim_Prefetcher * prefetcher = cache->prefetcher;
+    CSim_Access access;
+    access.type = CSIM_OPERATION_TYPE_LOAD;
+    access.address = block << cache->block_offset;
+    access.size = 1 << cache->block_offset;
+    access.next_use = CSIM_NEVER;
+    access.pc = 0;
+    access.thread = 0;
+    int set = csim_get_value(access.address, cache->set_mask, cache->set_offset);
+    uint64_t tag = csim_get_value(access.address, cache->tag_mask, cache->tag_offset);
+    CSim_Cache_Set * pset = &(cache->sets)[set];
+    CSim_Cache_Entry * pentry = pset->entries;
+    CSim_Pollution_Entry * slot;
+    int index, empty = -1;
+    for (index = 0 ; index < cache->line_number ; ++index) {
+        if (!pentry[index].valid_bit) {
+            if (empty < 0) {
+                empty = index;
+            }
+        } else if (pentry[index].tag_bit == tag) {
+            return;
+        }
+    }
+    if (empty >= 0) {
+        index = empty;
+    } else {
+        index = cache->policy->victim(cache, pset);
+        summary->evict++;
+        if (pentry[index].dirty_bit) {
+            summary->writeback++;
+        }
+        if (pentry[index].prefetched) {
+            prefetcher->result.unused++;
+        }
+        slot = csim_pollution_slot(prefetcher, set, pentry[index].tag_bit);
+        slot->valid = 1;
+        slot->set = set;
+        slot->tag = pentry[index].tag_bit;
+    }
+    slot = csim_pollution_slot(prefetcher, set, tag);
+    if (slot->valid && slot->set == set && slot->tag == tag) {
+        slot->valid = 0;
+    }
+    pentry[index].valid_bit = 1;
+    pentry[index].dirty_bit = 0;
+    pentry[index].tag_bit = tag;
+    pentry[index].prefetched = 1;
+    pentry[index].ready = cache->clock + prefetcher->latency;
+    cache->policy->fill(cache, pset, index, &access);
+    prefetcher->result.issued++;
+}
+
+/* a demand miss on a line a prefetch evicted */
+static void csim_pollution_check(CSim_Prefetcher * prefetcher, int set, uint64_t tag) {
+    CSim_Pollution_Entry * slot = csim_pollution_slot(prefetcher, set, tag);
+    if (slot->valid && slot->set == set && slot->tag == tag) {
+        prefetcher->result.polluting++;
+        slot->valid = 0;
+    }
+}
+
+/*
+ * Reference prediction table: each instruction (or page, for traces
+ * without instructions) remembers its last block and stride; once the
+ * same stride repeats, the next degree blocks along it are prefetched.
+ */
+static void csim_stride_train(CSim_Cache * cache, const CSim_Access * access, CSim_Cache_Result * summary) {
+    CSim_Prefetcher * prefetcher = cache->prefetcher;
+    uint64_t block = csim_block_of(cache, access->address);
+    uint64_t key = access->pc != 0 ? access->pc :
+                   (access->address >> CSIM_PAGE_BITS) | (1ULL << 63);
+    CSim_Stride_Entry * entry = NULL, * victim = &prefetcher->stride[0];
+    int64_t delta;
+    for (int index = 0 ; index < CSIM_STRIDE_ENTRIES ; ++index) {
+        CSim_Stride_Entry * candidate = &prefetcher->stride[index];
+        if (candidate->valid && candidate->key == key) {
+            entry = candidate;
+            break;
+        }
+        if (victim->valid && (!candidate->valid || candidate->stamp < victim->stamp)) {
+            victim = candidate;
+        }
+    }
+    if (entry == NULL) {
+        entry = victim;
+        entry->valid = 1;
+        entry->key = key;
+        entry->last_block = block;
+        entry->stride = 0;
+        entry->confidence = 0;
+        entry->stamp = cache->clock;
+        return;
+    }
+    entry->stamp = cache->clock;
+    delta = (int64_t)(block - entry->last_block);
+    if (delta == 0) {
+        return;
+    }
+    if (delta == entry->stride) {
+        entry->confidence++;
+    } else {
+        entry->stride = delta;
+        entry->confidence = 0;
+    }
+    entry->last_block = block;
+    if (entry->confidence > 0) {
+        for (int distance = 1 ; distance <= prefetcher->degree ; ++distance) {
+            csim_prefetch_fill(cache, block + entry->stride * distance, summary);
+        }
+    }
+}
+
+/* top up a stream buffer to its depth */
+static void csim_stream_refill(CSim_Cache * cache, CSim_Stream_Buffer * buffer) {
+    CSim_Prefetcher * prefetcher = cache->prefetcher;
+    while (buffer->count < prefetcher->degree) {
+        buffer->ready[(buffer->head + buffer->count) % prefetcher->degree] = cache->clock + prefetcher->latency;
+        buffer->count++;
+        prefetcher->result.issued++;
+    }
+}
+
+/*
+ * Look a missing block up in the stream buffers. On a hit the blocks
+ * before it are dropped and the buffer is topped up behind it. On a miss
+ * that follows a recent miss on the block before, the least recently used
+ * buffer restarts at the next block; other misses are only remembered, so
+ * that scattered misses do not flush buffers that are streaming.
+ */
+static int csim_stream_access(CSim_Cache * cache, uint64_t block) {
+    CSim_Prefetcher * prefetcher = cache->prefetcher;
+    CSim_Stream_Buffer * buffer, * victim = &prefetcher->stream[0];
+    int index;
+    for (index = 0 ; index < CSIM_STREAM_BUFFERS ; ++index) {
+        buffer = &prefetcher->stream[index];
+        if (buffer->valid && block >= buffer->head && block - buffer->head < (uint64_t)buffer->count) {
+            prefetcher->result.unused += block - buffer->head;
+            prefetcher->result.useful++;
+            if (cache->clock < buffer->ready[block % prefetcher->degree]) {
+                prefetcher->result.late++;
+            }
+            buffer->count -= block - buffer->head + 1;
+            buffer->head = block + 1;
+            buffer->stamp = cache->clock;
+            csim_stream_refill(cache, buffer);
+            return 1;
+        }
+        if (victim->valid && (!buffer->valid || buffer->stamp < victim->stamp)) {
+            victim = buffer;
+        }
+    }
+    for (index = 0 ; index < CSIM_STREAM_HISTORY ; ++index) {
+        if (prefetcher->misses[index] == block) {
+            break;
+        }
+    }
+    if (index == CSIM_STREAM_HISTORY) {
+        prefetcher->misses[prefetcher->next_miss] = block + 1;
+        prefetcher->next_miss = (prefetcher->next_miss + 1) % CSIM_STREAM_HISTORY;
+        return 0;
+    }
+    if (victim->valid) {
+        prefetcher->result.unused += victim->count;
+    }
+    victim->valid = 1;
+    victim->head = block + 1;
+    victim->count = 0;
+    victim->stamp = cache->clock;
+    csim_stream_refill(cache, victim);
+    return 0;
+}
+
+CSIM_OPERATION_RESULT csim_access_cache(CSim_Cache * cache, const CSim_Access * access, CSim_Cache_Result * summary, char verbose_flag) {
+    /* separate set and tag according to mask and offset */
+    int set = csim_get_value(access->address, cache->set_mask, cache->set_offset);
+    uint64_t tag = csim_get_value(access->address, cache->tag_mask, cache->tag_offset);
+    CSim_Cache_Set * pset = &(cache->sets)[set];
+    CSim_Cache_Entry * pentry = pset->entries;
+    CSIM_OPERATION_RESULT result = CSIM_OPERATION_RESULT_MISS_EVICTION;
+    CSim_Prefetcher * prefetcher = cache->prefetcher;
+    /* trigger: a miss or first use of a prefetch; streamed: a miss the stream buffers served */
+    char trigger = 0, streamed = 0;
+    int index, empty = -1;
+    cache->clock++;
+    /* determine the cache result */
+    for (index = 0 ; index < cache->line_number ; ++index) {
+        if (!pentry[index].valid_bit) {
+            if (empty < 0) {
+                empty = index;
+            }
+        } else if (pentry[index].tag_bit == tag) {
+            result = CSIM_OPERATION_RESULT_HIT;
+            break;
+        }
+    }
+    if (result != CSIM_OPERATION_RESULT_HIT && empty >= 0) {
+        result = CSIM_OPERATION_RESULT_MISS;
+        index = empty;
+    }
+    if (prefetcher != NULL) {
+        if (result == CSIM_OPERATION_RESULT_HIT) {
+            if (pentry[index].prefetched) {
+                csim_prefetch_used(cache, &pentry[index]);
+                trigger = 1;
+            }
+        } else {
+            trigger = 1;
+            if (prefetcher->type == CSIM_PREFETCH_TYPE_STREAM) {
+                streamed = csim_stream_access(cache, csim_block_of(cache, access->address));
+            }
+            if (!streamed) {
+                csim_pollution_check(prefetcher, set, tag);
+            }
+        }
+    }
+    /* simulate according to the result of cache behavior */
+    switch(result) {
+        case CSIM_OPERATION_RESULT_MISS:
             if (verbose_flag) {
-                while ((*line_pointer) != '\n') {
-                    putchar(*line_pointer++);
+                printf(streamed ? " stream" : " miss");
+            }
+            pentry[index].valid_bit = 1;
+            pentry[index].dirty_bit = 0;
+            pentry[index].tag_bit = tag;
+            pentry[index].prefetched = 0;
+            cache->policy->fill(cache, pset, index, access);
+            if (streamed) {
+                summary->hit++;
+            } else {
+                summary->miss++;
+            }
+            break;
+        case CSIM_OPERATION_RESULT_MISS_EVICTION:
+            if (verbose_flag) {
+                printf(streamed ? " stream eviction" : " miss eviction");
+            }
+            index = cache->policy->victim(cache, pset);
+            /* write-back cache: a dirty victim goes to memory */
+            if (pentry[index].dirty_bit) {
+                summary->writeback++;
+            }
+            if (prefetcher != NULL && pentry[index].prefetched) {
+                prefetcher->result.unused++;
+            }
+            pentry[index].dirty_bit = 0;
+            pentry[index].tag_bit = tag;
+            pentry[index].prefetched = 0;
+            cache->policy->fill(cache, pset, index, access);
+            if (streamed) {
+                summary->hit++;
+            } else {
+                summary->miss++;
+            }
+            summary->evict++;
+            break;
+        case CSIM_OPERATION_RESULT_HIT:
+            if (verbose_flag) {
+                printf(" hit");
+            }
+            cache->policy->hit(cache, pset, index, access);
+            summary->hit++;
+            break;
+    }
+    /* write-allocate: stores dirty the line whether they hit or not */
+    if (access->type == CSIM_OPERATION_TYPE_STORE || access->type == CSIM_OPERATION_TYPE_MODIFY) {
+        pentry[index].dirty_bit = 1;
+    }
+    if (access->type == CSIM_OPERATION_TYPE_MODIFY) {
+        if (verbose_flag) {
+            printf(" hit");
+        }
+        summary->hit++;
+    }
+    /* prefetches go out after the demand access has its line */
+    if (prefetcher != NULL) {
+        switch(prefetcher->type) {
+            case CSIM_PREFETCH_TYPE_NEXT:
+                for (int distance = 1 ; trigger && distance <= prefetcher->degree ; ++distance) {
+                    csim_prefetch_fill(cache, csim_block_of(cache, access->address) + distance, summary);
                 }
+                break;
+            case CSIM_PREFETCH_TYPE_STRIDE:
+                csim_stride_train(cache, access, summary);
+                break;
+            default:
+                break;
+        }
+    }
+    return streamed ? CSIM_OPERATION_RESULT_HIT : result;
+}
+
+/* next access of the loaded trace if there is one, else read from the file */
+const CSim_Access * csim_next_access(CSim_Trace * trace, CSim_Access * accesses, size_t count, size_t * pposition, CSim_Access * current) {
+    if (accesses != NULL) {
+        return *pposition < count ? &accesses[(*pposition)++] : NULL;
+    }
+    return csim_read_access(trace, current) ? current : NULL;
+}
+
+CSim_Cache_Result csim_parse_trace_file(CSim_Cache * cache, CSim_Trace * trace, char verbose_flag) {
+    /* whole trace for look-ahead policies, a single access otherwise */
+    CSim_Access * accesses = NULL;
+    CSim_Access current;
+    size_t count = 0, position = 0;
+    /* simulation result */
+    CSim_Cache_Result summary = {0, 0, 0, 0, 0};
+    if (cache->policy->need_future) {
+        accesses = csim_load_trace(trace, &count);
+        csim_build_next_use(cache, accesses, count);
+    }
+    /* simulation process */
+    const CSim_Access * access;
+    while ((access = csim_next_access(trace, accesses, count, &position, &current)) != NULL) {
+        if (verbose_flag) {
+            printf("%c %llx,%d", " MLS"[access->type], (unsigned long long)access->address, access->size);
+        }
+        csim_access_cache(cache, access, &summary, verbose_flag);
+        if (verbose_flag) {
+            putchar('\n');
+        }
+    }
+    free(accesses);
+    summary.dirty = csim_count_dirty(cache);
+    return summary;
+}
+
+static void csim_sample_add(CSim_Sample_Sums * sums, double a, double m) {
+    sums->n += 1;
+    sums->a += a;
+    sums->m += m;
+    sums->aa += a * a;
+    sums->mm += m * m;
+    sums->am += a * m;
+}
+
+/*
+ * Simulate a sample of the trace and scale it to the whole trace. Each
+ * sampled set or window is one cluster of references; the miss ratio is
+ * their ratio estimate, with its standard error from the spread of the
+ * clusters around it. When full_cache is given, every access is also
+ * simulated there so the estimate can be checked.
+ */
+CSim_Sample_Result csim_parse_trace_sampled(CSim_Cache * cache, CSim_Cache * full_cache, CSim_Trace * trace, const CSim_Sampling * sampling) {
+    CSim_Access * accesses = NULL;
+    CSim_Access current;
+    const CSim_Access * access;
+    size_t count = 0, position = 0;
+    CSim_Sample_Result result;
+    CSim_Sample_Sums sums = {0, 0, 0, 0, 0, 0};
+    /* counted references, the window being filled and warmup references */
+    CSim_Cache_Result counted = {0, 0, 0, 0, 0};
+    CSim_Cache_Result window = {0, 0, 0, 0, 0};
+    CSim_Cache_Result warmup = {0, 0, 0, 0, 0};
+    int set_count = 1 << cache->set_number, set, misses;
+    uint64_t * set_references = NULL, * set_misses = NULL;
+    uint64_t index = 0, phase;
+    double ratio, spread, fraction, variance;
+    memset(&result, 0, sizeof(result));
+    result.has_full = full_cache != NULL;
+    if (cache->policy->need_future || (full_cache != NULL && full_cache->policy->need_future)) {
+        accesses = csim_load_trace(trace, &count);
+        csim_build_next_use(cache, accesses, count);
+    }
+    if (sampling->type == CSIM_SAMPLING_TYPE_SET) {
+        set_references = calloc(set_count, sizeof(uint64_t));
+        set_misses = calloc(set_count, sizeof(uint64_t));
+        if (set_references == NULL || set_misses == NULL) {
+            csim_error_out_of_memory();
+            exit(CSIM_ERROR_OUT_OF_MEMORY);
+        }
+    }
+    /* simulation process */
+    while ((access = csim_next_access(trace, accesses, count, &position, &current)) != NULL) {
+        int references = access->type == CSIM_OPERATION_TYPE_MODIFY ? 2 : 1;
+        result.references += references;
+        if (full_cache != NULL) {
+            csim_access_cache(full_cache, access, &result.full, 0);
+        }
+        if (sampling->type == CSIM_SAMPLING_TYPE_SET) {
+            set = csim_get_value(access->address, cache->set_mask, cache->set_offset);
+            if (set % sampling->set_ratio == 0) {
+                misses = counted.miss;
+                csim_access_cache(cache, access, &counted, 0);
+                set_references[set] += references;
+                set_misses[set] += counted.miss - misses;
             }
-            /* separate set and tag according to mask and offset */
-            set = csim_get_value(address, cache->set_mask, cache->set_offset);
-            tag = csim_get_value(address, cache->tag_mask, cache->tag_offset);
-            /* determine the cache result */
-            CSim_Cache_Entry * pentry = (cache->sets)[set].entries;
-            int index;
-            CSim_Cache_Entry temp;
-            for (index = 0; index < line_number ; ++index) {
-                if (!pentry[index].valid_bit) {
-                    result = CSIM_OPERATION_RESULT_MISS;
-                    break;
+        } else {
+            phase = index++ % sampling->period;
+            if (phase < sampling->warmup) {
+                csim_access_cache(cache, access, &warmup, 0);
+            } else if (phase < sampling->warmup + sampling->window) {
+                csim_access_cache(cache, access, &window, 0);
+                if (phase == sampling->warmup + sampling->window - 1) {
+                    csim_sample_add(&sums, window.hit + window.miss, window.miss);
+                    counted.hit += window.hit;
+                    counted.miss += window.miss;
+                    counted.evict += window.evict;
+                    counted.writeback += window.writeback;
+                    memset(&window, 0, sizeof(window));
                 }
-                if (pentry[index].tag_bit == tag) {
-                    result = CSIM_OPERATION_RESULT_HIT;
-                    break;
+            }
+        }
+    }
+    /* a window cut short by the end of the trace */
+    if (window.hit + window.miss > 0) {
+        csim_sample_add(&sums, window.hit + window.miss, window.miss);
+        counted.hit += window.hit;
+        counted.miss += window.miss;
+        counted.evict += window.evict;
+        counted.writeback += window.writeback;
+    }
+    if (sampling->type == CSIM_SAMPLING_TYPE_SET) {
+        for (set = 0 ; set < set_count ; set += sampling->set_ratio) {
+            csim_sample_add(&sums, set_references[set], set_misses[set]);
+        }
+    }
+    free(accesses);
+    free(set_references);
+    free(set_misses);
+    /* ratio estimate and its 95% interval */
+    result.units = sums.n;
+    result.sampled = sums.a;
+    ratio = sums.a > 0 ? sums.m / sums.a : 0;
+    result.miss_ratio = ratio;
+    if (sums.n >= 2 && sums.a > 0) {
+        spread = (sums.mm - 2 * ratio * sums.am + ratio * ratio * sums.aa) / (sums.n - 1);
+        fraction = sampling->type == CSIM_SAMPLING_TYPE_SET ? sums.n / set_count : sums.a / result.references;
+        variance = (fraction < 1 ? 1 - fraction : 0) * spread / (sums.n * (sums.a / sums.n) * (sums.a / sums.n));
+        result.miss_ratio_error = (sums.n <= sizeof(csim_sampling_t) / sizeof(csim_sampling_t[0])
+                                   ? csim_sampling_t[(int) sums.n - 1] : CSIM_SAMPLING_Z)
+                                  * sqrt(variance > 0 ? variance : 0);
+    }
+    /* scale the counted references to the whole trace */
+    if (sums.a > 0) {
+        result.estimate.miss = llround(ratio * result.references);
+        result.estimate.hit = result.references - result.estimate.miss;
+        result.estimate.evict = llround(counted.evict / sums.a * result.references);
+        result.estimate.writeback = llround(counted.writeback / sums.a * result.references);
+    }
+    result.estimate.dirty = csim_count_dirty(cache);
+    if (sampling->type == CSIM_SAMPLING_TYPE_SET) {
+        result.estimate.dirty = llround((double)result.estimate.dirty * set_count / sums.n);
+    }
+    if (full_cache != NULL) {
+        result.full.dirty = csim_count_dirty(full_cache);
+    }
+    return result;
+}
+
+/*
+ * Print how the sample was taken, the estimated miss ratio with its 95%
+ * interval, and how the full simulation compares when there is one.
+ */
+void csim_print_sampling(const CSim_Sampling * sampling, const CSim_Sample_Result * result) {
+    double low = fmax(result->miss_ratio - result->miss_ratio_error, 0);
+    double high = fmin(result->miss_ratio + result->miss_ratio_error, 1);
+    double full_ratio;
+    if (sampling->type == CSIM_SAMPLING_TYPE_SET) {
+        printf("sampling: 1 set in %d, %d sets", sampling->set_ratio, result->units);
+    } else {
+        printf("sampling: %llu of every %llu accesses after %llu warmup, %d windows",
+               (unsigned long long)sampling->window, (unsigned long long)sampling->period,
+               (unsigned long long)sampling->warmup, result->units);
+    }
+    printf(", %llu of %llu references counted\n",
+           (unsigned long long)result->sampled, (unsigned long long)result->references);
+    /* one unit says nothing about the spread between units */
+    if (result->units < 2) {
+        printf("miss ratio %.5f +/- n/a (95%%), too few %s for an interval\n",
+               result->miss_ratio,
+               sampling->type == CSIM_SAMPLING_TYPE_SET ? "sets" : "windows");
+    } else {
+        printf("miss ratio %.5f +/- %.5f (95%%), misses %.0f to %.0f\n",
+               result->miss_ratio, result->miss_ratio_error,
+               low * result->references, high * result->references);
+    }
+    if (result->has_full) {
+        full_ratio = result->full.hit + result->full.miss > 0 ?
+                     (double)result->full.miss / (result->full.hit + result->full.miss) : 0;
+        printf("full: hits:%d misses:%d evictions:%d miss ratio %.5f",
+               result->full.hit, result->full.miss, result->full.evict, full_ratio);
+        if (result->units >= 2) {
+            printf(", %s the interval",
+                   full_ratio >= low && full_ratio <= high ? "inside" : "outside");
+        }
+        printf("\n");
+    }
+}
+
+/*
+ * Print memory traffic next to printSummary's numbers: every miss fills a
+ * block from memory, and every dirty eviction writes one back. Lines still
+ * dirty at the end are reported separately, as a final flush would write them.
+ */
+void csim_print_traffic(CSim_Cache * cache, CSim_Cache_Result summary) {
+    unsigned long long block_size = 1ULL << cache->block_offset;
+    /* prefetched blocks are read from memory too, used or not */
+    unsigned long long reads = summary.miss + (cache->prefetcher != NULL ? cache->prefetcher->result.issued : 0);
+    printf("writebacks:%d dirty:%d bytes_read:%llu bytes_written:%llu bytes_flushed:%llu\n",
+           summary.writeback, summary.dirty,
+           reads * block_size, summary.writeback * block_size,
+           summary.dirty * block_size);
+}
+
+/*
+ * Print the prefetcher counters. Accuracy is the share of issued
+ * prefetches that were used; late ones are included in useful.
+ */
+void csim_print_prefetch(CSim_Cache * cache) {
+    CSim_Prefetcher * prefetcher = cache->prefetcher;
+    if (prefetcher == NULL) {
+        return;
+    }
+    printf("prefetch:%s degree:%d latency:%d issued:%d useful:%d late:%d unused:%d polluting:%d accuracy:%.2f%%\n",
+           csim_prefetch_names[prefetcher->type], prefetcher->degree, prefetcher->latency,
+           prefetcher->result.issued, prefetcher->result.useful, prefetcher->result.late,
+           prefetcher->result.unused, prefetcher->result.polluting,
+           prefetcher->result.issued > 0 ? 100.0 * prefetcher->result.useful / prefetcher->result.issued : 0);
+}
+
+CSIM_PROTOCOL_TYPE csim_find_protocol(const char * name) {
+    for (int index = 0 ; index < CSIM_PROTOCOL_TYPE_COUNT ; ++index) {
+        if (strcmp(csim_protocol_names[index], name) == 0) {
+            return index;
+        }
+    }
+    return CSIM_PROTOCOL_TYPE_COUNT;
+}
+
+CSim_System * csim_construct_system(int cores, CSIM_PROTOCOL_TYPE protocol, int set_number, int line_number, int block_offset, const CSim_Cache_Policy * policy, int llc_set_number, int llc_line_number) {
+    CSim_System * system = calloc(1, sizeof(CSim_System));
+    if (system == NULL) {
+        csim_error_out_of_memory();
+        exit(CSIM_ERROR_OUT_OF_MEMORY);
+    }
+    system->cores = cores;
+    system->protocol = protocol;
+    system->chunk_shift = block_offset > 6 ? block_offset - 6 : 0;
+    for (int core = 0 ; core < cores ; ++core) {
+        system->l1[core] = csim_construct_cache(set_number, line_number, block_offset, policy);
+    }
+    system->llc = csim_construct_cache(llc_set_number, llc_line_number, block_offset, policy);
+    return system;
+}
+
+void csim_deconstruct_system(CSim_System ** psystem) {
+    CSim_System * temp = *psystem;
+    for (int core = 0 ; core < temp->cores ; ++core) {
+        csim_deconstruct_cache(&(temp->l1)[core]);
+    }
+    csim_deconstruct_cache(&temp->llc);
+    free(temp->blocks);
+    free(temp);
+    *psystem = NULL;
+}
+
+/* index of the line holding address, or -1; the first empty line goes to *pempty */
+static int csim_find_line(CSim_Cache * cache, uint64_t address, int * pempty) {
+    int set = csim_get_value(address, cache->set_mask, cache->set_offset);
+    uint64_t tag = csim_get_value(address, cache->tag_mask, cache->tag_offset);
+    CSim_Cache_Entry * pentry = (cache->sets)[set].entries;
+    int empty = -1;
+    for (int index = 0 ; index < cache->line_number ; ++index) {
+        if (!pentry[index].valid_bit) {
+            if (empty < 0) {
+                empty = index;
+            }
+        } else if (pentry[index].tag_bit == tag) {
+            return index;
+        }
+    }
+    if (pempty != NULL) {
+        *pempty = empty;
+    }
+    return -1;
+}
+
+static CSim_Cache_Entry * csim_line_entry(CSim_Cache * cache, uint64_t address, int index) {
+    int set = csim_get_value(address, cache->set_mask, cache->set_offset);
+    return &(cache->sets)[set].entries[index];
+}
+
+/* parts of its block an access touches, one bit per 64th of the block */
+static uint64_t csim_sharing_mask(CSim_System * system, const CSim_Access * access) {
+    uint64_t block_size = 1ULL << system->llc->block_offset;
+    uint64_t first = access->address & (block_size - 1);
+    uint64_t last = first + (access->size > 0 ? access->size : 1) - 1;
+    int width;
+    if (last >= block_size) {
+        last = block_size - 1;
+    }
+    first >>= system->chunk_shift;
+    last >>= system->chunk_shift;
+    width = last - first + 1;
+    return (width == 64 ? ~0ULL : (1ULL << width) - 1) << first;
+}
+
+/* sharing record of a block, created if asked for; NULL when there is none */
+static CSim_Sharing_Block * csim_sharing_block(CSim_System * system, uint64_t block, char create) {
+    size_t slot;
+    if (system->block_capacity == 0 || (create && system->block_count * 2 >= system->block_capacity)) {
+        if (!create) {
+            return NULL;
+        }
+        /* grow and rehash */
+        size_t capacity = system->block_capacity ? system->block_capacity * 2 : 64;
+        CSim_Sharing_Block * blocks = calloc(capacity, sizeof(CSim_Sharing_Block));
+        if (blocks == NULL) {
+            csim_error_out_of_memory();
+            exit(CSIM_ERROR_OUT_OF_MEMORY);
+        }
+        for (size_t index = 0 ; index < system->block_capacity ; ++index) {
+            if (system->blocks[index].used) {
+                slot = (size_t)((system->blocks[index].block * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+                while (blocks[slot].used) {
+                    slot = (slot + 1) & (capacity - 1);
                 }
+                blocks[slot] = system->blocks[index];
+            }
+        }
+        free(system->blocks);
+        system->blocks = blocks;
+        system->block_capacity = capacity;
+    }
+    slot = (size_t)((block * 0x9E3779B97F4A7C15ULL) >> 32) & (system->block_capacity - 1);
+    while (system->blocks[slot].used) {
+        if (system->blocks[slot].block == block) {
+            return &system->blocks[slot];
+        }
+        slot = (slot + 1) & (system->block_capacity - 1);
+    }
+    if (!create) {
+        return NULL;
+    }
+    system->blocks[slot].used = 1;
+    system->blocks[slot].block = block;
+    system->block_count++;
+    return &system->blocks[slot];
+}
+
+/* read or write a block of the shared last-level cache */
+static void csim_system_llc(CSim_System * system, uint64_t address, CSIM_OPERATION_TYPE type) {
+    CSim_Access access;
+    access.type = type;
+    access.address = address;
+    access.size = 1 << system->llc->block_offset;
+    access.next_use = CSIM_NEVER;
+    access.pc = 0;
+    access.thread = 0;
+    csim_access_cache(system->llc, &access, &system->llc_result, 0);
+}
+
+/*
+ * Invalidate the copies other cores hold of a block core is about to
+ * write. Returns 1 if one of them was dirty, in which case it passes its
+ * data straight to the writer.
+ */
+static int csim_system_invalidate(CSim_System * system, int core, uint64_t address) {
+    uint64_t block = address >> system->llc->block_offset;
+    CSim_Sharing_Block * sharing = NULL;
+    int supplied = 0;
+    for (int other = 0 ; other < system->cores ; ++other) {
+        int index = other == core ? -1 : csim_find_line(system->l1[other], address, NULL);
+        if (index < 0) {
+            continue;
+        }
+        CSim_Cache_Entry * pentry = csim_line_entry(system->l1[other], address, index);
+        if (pentry->state == CSIM_COHERENCE_STATE_MODIFIED || pentry->state == CSIM_COHERENCE_STATE_OWNED) {
+            supplied = 1;
+        }
+        pentry->valid_bit = 0;
+        pentry->dirty_bit = 0;
+        pentry->state = CSIM_COHERENCE_STATE_INVALID;
+        system->core[other].invalidated++;
+        system->core[core].invalidations++;
+        if (sharing == NULL) {
+            sharing = csim_sharing_block(system, block, 1);
+        }
+        sharing->invalidated |= 1u << other;
+        sharing->cores |= 1u << other;
+        sharing->written[other] = 0;
+        sharing->invalidations++;
+    }
+    return supplied;
+}
+
+/*
+ * One load or store of a core. A miss snoops the other cores: a load
+ * takes a dirty line from its owner, which keeps it as owned under MOESI
+ * or writes it back and shares it under MESI, and a store invalidates
+ * every other copy. A miss on a line another core invalidated is a
+ * coherence miss; it is true sharing if it touches bytes written since,
+ * false sharing otherwise.
+ */
+static void csim_system_reference(CSim_System * system, int core, const CSim_Access * access, char write, char verbose_flag) {
+    CSim_Cache * cache = system->l1[core];
+    CSim_Core_Result * result = &(system->core)[core];
+    uint64_t block = access->address >> cache->block_offset;
+    uint64_t mask = csim_sharing_mask(system, access);
+    int set = csim_get_value(access->address, cache->set_mask, cache->set_offset);
+    CSim_Cache_Set * pset = &(cache->sets)[set];
+    CSim_Cache_Entry * pentry;
+    CSim_Sharing_Block * sharing;
+    int index, empty = -1, shared = 0, supplied = 0;
+    cache->clock++;
+    index = csim_find_line(cache, access->address, &empty);
+    if (index >= 0) {
+        if (verbose_flag) {
+            printf(" hit");
+        }
+        pentry = &pset->entries[index];
+        cache->policy->hit(cache, pset, index, access);
+        result->cache.hit++;
+        if (write && (pentry->state == CSIM_COHERENCE_STATE_SHARED || pentry->state == CSIM_COHERENCE_STATE_OWNED)) {
+            if (verbose_flag) {
+                printf(" upgrade");
             }
-            /* simulate according to the result of cache behavior */
-            switch(result) {
-                case CSIM_OPERATION_RESULT_MISS:
-                    if (verbose_flag) {
-                        printf(" miss");
-                    }
-                    pentry[index].valid_bit = 1;
-                    pentry[index].tag_bit = tag;
-                    summary.miss++;
-                    break;
-                case CSIM_OPERATION_RESULT_MISS_EVICTION:
-                    if (verbose_flag) {
-                        printf(" miss eviction");
-                    }
-                    pentry[0].tag_bit = tag;
-                    temp = pentry[0];
-                    for (index = 0 ; index < line_number - 1 ; ++index) {
-                        pentry[index] = pentry[index + 1];
-                    }
-                    pentry[index] = temp;
-                    summary.miss++;
-                    summary.evict++;
-                    break;
-                case CSIM_OPERATION_RESULT_HIT:
-                    if (verbose_flag) {
-                        printf(" hit");
-                    }
-                    temp = pentry[index];
-                    for ( ; (index < line_number - 1) && (pentry[index + 1].valid_bit) ; ++index) {
-                        pentry[index] = pentry[index + 1];
-                    }
-                    pentry[index] = temp;
-                    summary.hit++;
-                    break;
+            csim_system_invalidate(system, core, access->address);
+            result->upgrades++;
+        }
+    } else {
+        result->cache.miss++;
+        sharing = csim_sharing_block(system, block, 0);
+        if (sharing != NULL && (sharing->invalidated >> core & 1)) {
+            char true_sharing = (sharing->written[core] & mask) != 0;
+            if (verbose_flag) {
+                printf(true_sharing ? " coherence-miss" : " false-sharing-miss");
             }
-            if (type == CSIM_OPERATION_TYPE_MODIFY) {
-                if (verbose_flag) {
-                    printf(" hit");
+            sharing->invalidated &= ~(1u << core);
+            result->coherence_miss++;
+            if (true_sharing) {
+                result->true_sharing++;
+                sharing->true_sharing++;
+            } else {
+                result->false_sharing++;
+                sharing->false_sharing++;
+            }
+        } else if (verbose_flag) {
+            printf(" miss");
+        }
+        /* snoop the other cores */
+        if (write) {
+            supplied = csim_system_invalidate(system, core, access->address);
+        } else {
+            for (int other = 0 ; other < system->cores ; ++other) {
+                int other_index = other == core ? -1 : csim_find_line(system->l1[other], access->address, NULL);
+                if (other_index < 0) {
+                    continue;
+                }
+                CSim_Cache_Entry * pother = csim_line_entry(system->l1[other], access->address, other_index);
+                shared = 1;
+                switch(pother->state) {
+                    case CSIM_COHERENCE_STATE_MODIFIED:
+                        supplied = 1;
+                        if (system->protocol == CSIM_PROTOCOL_TYPE_MOESI) {
+                            pother->state = CSIM_COHERENCE_STATE_OWNED;
+                        } else {
+                            pother->state = CSIM_COHERENCE_STATE_SHARED;
+                            pother->dirty_bit = 0;
+                            system->core[other].cache.writeback++;
+                            csim_system_llc(system, access->address, CSIM_OPERATION_TYPE_STORE);
+                        }
+                        break;
+                    case CSIM_COHERENCE_STATE_OWNED:
+                        supplied = 1;
+                        break;
+                    case CSIM_COHERENCE_STATE_EXCLUSIVE:
+                        pother->state = CSIM_COHERENCE_STATE_SHARED;
+                        break;
+                    default:
+                        break;
                 }
-                summary.hit++;
             }
+        }
+        if (supplied) {
+            result->transfers++;
+        } else {
+            csim_system_llc(system, access->address, CSIM_OPERATION_TYPE_LOAD);
+        }
+        /* fill, writing back a dirty victim to the last-level cache */
+        if (empty >= 0) {
+            index = empty;
+        } else {
             if (verbose_flag) {
-                putchar('\n');
+                printf(" eviction");
+            }
+            index = cache->policy->victim(cache, pset);
+            pentry = &pset->entries[index];
+            result->cache.evict++;
+            if (pentry->state == CSIM_COHERENCE_STATE_MODIFIED || pentry->state == CSIM_COHERENCE_STATE_OWNED) {
+                result->cache.writeback++;
+                csim_system_llc(system, (pentry->tag_bit << cache->tag_offset) | ((uint64_t)set << cache->set_offset),
+                                CSIM_OPERATION_TYPE_STORE);
             }
         }
+        pentry = &pset->entries[index];
+        pentry->valid_bit = 1;
+        pentry->dirty_bit = 0;
+        pentry->tag_bit = csim_get_value(access->address, cache->tag_mask, cache->tag_offset);
+        pentry->state = shared ? CSIM_COHERENCE_STATE_SHARED : CSIM_COHERENCE_STATE_EXCLUSIVE;
+        cache->policy->fill(cache, pset, index, access);
     }
-    return summary;
+    if (write) {
+        pentry->state = CSIM_COHERENCE_STATE_MODIFIED;
+        pentry->dirty_bit = 1;
+        /* cores waiting to refetch the block see these bytes as written */
+        if ((sharing = csim_sharing_block(system, block, 0)) != NULL) {
+            for (int other = 0 ; other < system->cores ; ++other) {
+                if (other != core && (sharing->invalidated >> other & 1)) {
+                    sharing->written[other] |= mask;
+                }
+            }
+        }
+    }
+}
+
+/* simulate one access on the core its thread runs on, thread modulo cores */
+void csim_access_system(CSim_System * system, const CSim_Access * access, char verbose_flag) {
+    int core = access->thread % system->cores;
+    switch(access->type) {
+        case CSIM_OPERATION_TYPE_LOAD:
+            csim_system_reference(system, core, access, 0, verbose_flag);
+            break;
+        case CSIM_OPERATION_TYPE_STORE:
+            csim_system_reference(system, core, access, 1, verbose_flag);
+            break;
+        case CSIM_OPERATION_TYPE_MODIFY:
+            csim_system_reference(system, core, access, 0, verbose_flag);
+            csim_system_reference(system, core, access, 1, verbose_flag);
+            break;
+        default:
+            break;
+    }
+}
+
+/* order sharing records by false sharing misses, then invalidations */
+static int csim_compare_sharing(const void * left, const void * right) {
+    const CSim_Sharing_Block * x = *(CSim_Sharing_Block * const *)left;
+    const CSim_Sharing_Block * y = *(CSim_Sharing_Block * const *)right;
+    if (x->false_sharing != y->false_sharing) {
+        return y->false_sharing - x->false_sharing;
+    }
+    return y->invalidations - x->invalidations;
 }
 
+/* print each core, the last-level cache and the blocks with the most false sharing */
+void csim_print_system(CSim_System * system) {
+    CSim_Sharing_Block ** hot = malloc((system->block_count + 1) * sizeof(CSim_Sharing_Block *));
+    size_t count = 0;
+    if (hot == NULL) {
+        csim_error_out_of_memory();
+        exit(CSIM_ERROR_OUT_OF_MEMORY);
+    }
+    printf("protocol:%s cores:%d\n", csim_protocol_names[system->protocol], system->cores);
+    for (int core = 0 ; core < system->cores ; ++core) {
+        CSim_Core_Result * result = &(system->core)[core];
+        printf("core %d: hits:%d misses:%d evictions:%d writebacks:%d coherence_misses:%d "
+               "true_sharing:%d false_sharing:%d invalidated:%d invalidations:%d upgrades:%d transfers:%d\n",
+               core, result->cache.hit, result->cache.miss, result->cache.evict, result->cache.writeback,
+               result->coherence_miss, result->true_sharing, result->false_sharing,
+               result->invalidated, result->invalidations, result->upgrades, result->transfers);
+    }
+    printf("llc: hits:%d misses:%d evictions:%d writebacks:%d\n",
+           system->llc_result.hit, system->llc_result.miss, system->llc_result.evict, system->llc_result.writeback);
+    for (size_t index = 0 ; index < system->block_capacity ; ++index) {
+        if (system->blocks[index].used && system->blocks[index].false_sharing > 0) {
+            hot[count++] = &system->blocks[index];
+        }
+    }
+    qsort(hot, count, sizeof(CSim_Sharing_Block *), csim_compare_sharing);
+    printf("false sharing hot blocks:%s\n", count == 0 ? " none" : "");
+    for (size_t index = 0 ; index < count && index < CSIM_HOT_BLOCKS ; ++index) {
+        printf("  %#llx invalidations:%d true_sharing:%d false_sharing:%d cores:",
+               (unsigned long long)(hot[index]->block << system->llc->block_offset),
+               hot[index]->invalidations, hot[index]->true_sharing, hot[index]->false_sharing);
+        for (int core = 0, first = 1 ; core < system->cores ; ++core) {
+            if (hot[index]->cores >> core & 1) {
+                printf(first ? "%d" : ",%d", core);
+                first = 0;
+            }
+        }
+        putchar('\n');
+    }
+    free(hot);
+}
+
+#ifndef CSIM_NO_MAIN
 int main(int argc, char *argv[]) {
     /* variables for argument parsing */
     char h = 0, v = 0, s = 0, E = 0, b = 0, t = 0;
     int opt;
     /* cache arguments */
     int set_number = 0, line_number = 0, block_offset = 0;
+    const CSim_Cache_Policy * policy = &csim_policies[CSIM_POLICY_TYPE_LRU];
     /* cache */
     CSim_Cache * cache = NULL;
     /* file path */
     char file_path[80];
     /* verbose flag */
     char verbose_flag = 0;
+    /* sampled simulation */
+    CSim_Sampling sampling = {CSIM_SAMPLING_TYPE_NONE, 0, 0, 0, 0};
+    CSim_Sample_Result sample_result;
+    CSim_Cache * full_cache = NULL;
+    unsigned long long period, warmup, window;
+    char compare = 0;
+    /* split accesses straddling blocks */
+    char split = 0;
+    /* hardware prefetcher */
+    CSIM_PREFETCH_TYPE prefetch_type = CSIM_PREFETCH_TYPE_NONE;
+    int prefetch_degree = 0, prefetch_latency = 0;
+    char prefetch_name[16];
+    /* coherent multi-core system */
+    CSim_System * system = NULL;
+    CSIM_PROTOCOL_TYPE protocol = CSIM_PROTOCOL_TYPE_MESI;
+    int cores = 0, llc_set_number = -1, llc_line_number = 0;
     /* summary */
-    CSim_Cache_Result summary = {0, 0, 0};
+    CSim_Cache_Result summary = {0, 0, 0, 0, 0};
     /* pre-operation */
     program_name = argv[0];
     /* argument parsing */
-    while ((opt = getopt(argc, argv, "hvs:E:b:t:")) != -1) {
+    while ((opt = getopt(argc, argv, "hvs:E:b:p:t:S:W:cP:xn:m:L:")) != -1) {
         switch(opt) {
             case 'h':
                 h = 1;
@@ -321,10 +1498,74 @@ int main(int argc, char *argv[]) {
                 }
                 b = 1;
                 break;
+            case 'p':
+                policy = csim_find_policy(optarg);
+                if (policy == NULL) {
+                    csim_error_invalid_policy(optarg);
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                break;
             case 't':
                 t = 1;
                 strcpy(file_path, optarg);
                 break;
+            case 'S':
+                sampling.type = CSIM_SAMPLING_TYPE_SET;
+                sampling.set_ratio = atoi(optarg);
+                if (sampling.set_ratio <= 0) {
+                    csim_print_help_info();
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                break;
+            case 'W':
+                sampling.type = CSIM_SAMPLING_TYPE_TIME;
+                if (sscanf(optarg, "%llu:%llu:%llu", &period, &warmup, &window) != 3 ||
+                    window == 0 || warmup + window > period) {
+                    csim_print_help_info();
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                sampling.period = period;
+                sampling.warmup = warmup;
+                sampling.window = window;
+                break;
+            case 'c':
+                compare = 1;
+                break;
+            case 'x':
+                split = 1;
+                break;
+            case 'n':
+                cores = atoi(optarg);
+                if (cores <= 0 || cores > CSIM_MAX_CORES) {
+                    csim_print_help_info();
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                break;
+            case 'm':
+                protocol = csim_find_protocol(optarg);
+                if (protocol == CSIM_PROTOCOL_TYPE_COUNT) {
+                    printf("%s: Unknown coherence protocol '%s'\n", program_name, optarg);
+                    csim_print_help_info();
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                break;
+            case 'L':
+                if (sscanf(optarg, "%d:%d", &llc_set_number, &llc_line_number) != 2 ||
+                    llc_set_number < 0 || llc_line_number <= 0) {
+                    csim_print_help_info();
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                break;
+            case 'P':
+                prefetch_degree = 0;
+                prefetch_latency = 0;
+                if (sscanf(optarg, "%15[^:]:%d:%d", prefetch_name, &prefetch_degree, &prefetch_latency) < 1 ||
+                    (prefetch_type = csim_find_prefetcher(prefetch_name)) == CSIM_PREFETCH_TYPE_COUNT ||
+                    prefetch_degree < 0 || prefetch_degree > CSIM_PREFETCH_DEGREE_MAX || prefetch_latency < 0) {
+                    csim_error_invalid_prefetcher(optarg);
+                    return CSIM_ERROR_INVALID_OPTION;
+                }
+                break;
             default:
                 csim_print_help_info();
                 return CSIM_ERROR_INVALID_OPTION;
@@ -342,20 +1583,87 @@ int main(int argc, char *argv[]) {
         csim_error_missing_argument();
         return CSIM_ERROR_MISSING_ARGUMENT;
     }
+    /* sampled counts are scaled up, prefetch counters could not be */
+    if (sampling.type != CSIM_SAMPLING_TYPE_NONE && prefetch_type != CSIM_PREFETCH_TYPE_NONE) {
+        printf("%s: -P cannot be combined with -S or -W\n", program_name);
+        return CSIM_ERROR_INVALID_OPTION;
+    }
+    /* a multi-core run simulates every access of every core */
+    if (cores > 0 && (sampling.type != CSIM_SAMPLING_TYPE_NONE || prefetch_type != CSIM_PREFETCH_TYPE_NONE ||
+                      policy->need_future)) {
+        printf("%s: -n cannot be combined with -S, -W, -P or policy %s\n", program_name, policy->name);
+        return CSIM_ERROR_INVALID_OPTION;
+    }
     /* file processing */
     FILE * file_pointer = fopen(file_path, "r");
     if (file_pointer == NULL) {
         csim_error_file_cannot_open(file_path);
         return CSIM_ERROR_FILE_CANNOT_OPEN;
     }
+    /* binary traces are recognized by their header */
+    CSim_Trace trace = {file_pointer, bintrace_open_read(file_pointer), 0, split ? block_offset : 0};
+    /* multi-core simulation, by default over a last-level cache of 8 times the sets */
+    if (cores > 0) {
+        if (llc_set_number < 0) {
+            llc_set_number = set_number + 3;
+            llc_line_number = line_number;
+        }
+        system = csim_construct_system(cores, protocol, set_number, line_number, block_offset, policy,
+                                       llc_set_number, llc_line_number);
+        CSim_Access access;
+        while (csim_read_access(&trace, &access)) {
+            if (verbose_flag) {
+                printf("%c %llx,%d %d", " MLS"[access.type], (unsigned long long)access.address,
+                       access.size, access.thread);
+            }
+            csim_access_system(system, &access, verbose_flag);
+            if (verbose_flag) {
+                putchar('\n');
+            }
+        }
+        for (int core = 0 ; core < cores ; ++core) {
+            summary.hit += system->core[core].cache.hit;
+            summary.miss += system->core[core].cache.miss;
+            summary.evict += system->core[core].cache.evict;
+        }
+        printSummary(summary.hit, summary.miss, summary.evict);
+        csim_print_system(system);
+        csim_deconstruct_system(&system);
+        if (trace.binary != NULL) {
+            bintrace_close(trace.binary);
+        }
+        fclose(file_pointer);
+        return CSIM_OK;
+    }
     /* cache construction */
-    cache = csim_construct_cache(set_number, line_number, block_offset);
+    cache = csim_construct_cache(set_number, line_number, block_offset, policy);
+    csim_attach_prefetcher(cache, prefetch_type, prefetch_degree, prefetch_latency);
     /* trace file parsing */
-    summary = csim_parse_trace_file(cache, file_pointer, verbose_flag);
+    if (sampling.type != CSIM_SAMPLING_TYPE_NONE) {
+        if (compare) {
+            full_cache = csim_construct_cache(set_number, line_number, block_offset, policy);
+        }
+        sample_result = csim_parse_trace_sampled(cache, full_cache, &trace, &sampling);
+        summary = sample_result.estimate;
+    } else {
+        summary = csim_parse_trace_file(cache, &trace, verbose_flag);
+    }
     /* summary */
     printSummary(summary.hit, summary.miss, summary.evict);
+    csim_print_traffic(cache, summary);
+    csim_print_prefetch(cache);
+    if (sampling.type != CSIM_SAMPLING_TYPE_NONE) {
+        csim_print_sampling(&sampling, &sample_result);
+    }
     /* post operations */
     csim_deconstruct_cache(&cache);
+    if (full_cache != NULL) {
+        csim_deconstruct_cache(&full_cache);
+    }
+    if (trace.binary != NULL) {
+        bintrace_close(trace.binary);
+    }
     fclose(file_pointer);
     return CSIM_OK;
 }
+#endif /* CSIM_NO_MAIN */
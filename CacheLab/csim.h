@@ -0,0 +1,328 @@
+/*
+ * csim.h - Cache simulator core of csim, usable as a library
+ *
+ * Compiling csim.c with -DCSIM_NO_MAIN leaves out the command line
+ * driver, so other programs (test-trans) can construct a cache, feed
+ * it accesses with csim_access_cache() and read back the result.
+ */
+
+#ifndef CSIM_H
+#define CSIM_H
+
+#include "stdio.h"
+#include "stdint.h"
+
+#include "bintrace.h"
+
+/* cache struct definition */
+typedef struct CSim_Cache_Entry {
+    char valid_bit;
+    char dirty_bit;
+    uint64_t tag_bit;
+    /* replacement metadata */
+    uint64_t stamp;     /* time of last use (LRU) or of fill (FIFO) */
+    uint64_t next_use;  /* position of next reference (OPT) */
+    int rrpv;           /* re-reference prediction value (RRIP) */
+    /* prefetch state */
+    char prefetched;    /* filled by the prefetcher and not used since */
+    uint64_t ready;     /* clock at which a prefetched block arrives */
+    /* coherence state in a multi-core system (CSIM_COHERENCE_STATE) */
+    char state;
+}CSim_Cache_Entry;
+
+typedef struct CSim_Cache_Set{
+    CSim_Cache_Entry * entries;
+    unsigned char * plru_bits;  /* tree nodes of tree-PLRU, 1-indexed */
+}CSim_Cache_Set;
+
+typedef struct CSim_Cache_Policy CSim_Cache_Policy;
+typedef struct CSim_Prefetcher CSim_Prefetcher;
+
+typedef struct CSim_Cache {
+    /* basic arguments */
+    int block_offset;
+    int set_number;
+    int line_number;
+    /* masks and offsets */
+    int tag_offset;
+    int set_offset;
+    uint64_t tag_mask;
+    uint64_t set_mask;
+    /* replacement policy and its state */
+    const CSim_Cache_Policy * policy;
+    int plru_leaves;
+    uint64_t clock;
+    uint64_t random_state;
+    /* hardware prefetcher, NULL when there is none */
+    CSim_Prefetcher * prefetcher;
+    /* cache */
+    CSim_Cache_Set * sets;
+}CSim_Cache;
+
+/* simulation result definition */
+typedef struct CSim_Cache_Result {
+    int hit;
+    int miss;
+    int evict;
+    /* write-back accounting */
+    int writeback;  /* dirty lines written to memory on eviction */
+    int dirty;      /* lines still dirty when the trace ends */
+}CSim_Cache_Result;
+
+/* operation type definition */
+typedef enum CSIM_OPERATION_TYPE {
+    CSIM_OPERATION_TYPE_NONE,
+    CSIM_OPERATION_TYPE_MODIFY,
+    CSIM_OPERATION_TYPE_LOAD,
+    CSIM_OPERATION_TYPE_STORE,
+}CSIM_OPERATION_TYPE;
+
+/* operation result definition */
+typedef enum CSIM_OPERATION_RESULT {
+    CSIM_OPERATION_RESULT_MISS,
+    CSIM_OPERATION_RESULT_HIT,
+    CSIM_OPERATION_RESULT_MISS_EVICTION,
+}CSIM_OPERATION_RESULT;
+
+/* single memory access definition */
+typedef struct CSim_Access {
+    CSIM_OPERATION_TYPE type;
+    uint64_t address;
+    int size;
+    uint64_t next_use;  /* filled in only when the policy needs the future */
+    uint64_t pc;        /* instruction making the access, 0 when unknown */
+    int thread;         /* thread making the access, 0 when the trace has one */
+}CSim_Access;
+
+/* trace source, either lackey text or a binary trace */
+typedef struct CSim_Trace {
+    FILE * file_pointer;
+    bintrace_t * binary;
+    uint64_t pc;        /* address of the last instruction record */
+    /* block offset bits to split accesses straddling blocks at, 0 to keep them whole */
+    int split_offset;
+    CSim_Access rest;   /* rest of a split access, pending while its size is positive */
+}CSim_Trace;
+
+/* replacement policy definition */
+typedef enum CSIM_POLICY_TYPE {
+    CSIM_POLICY_TYPE_LRU,
+    CSIM_POLICY_TYPE_FIFO,
+    CSIM_POLICY_TYPE_RANDOM,
+    CSIM_POLICY_TYPE_PLRU,
+    CSIM_POLICY_TYPE_SRRIP,
+    CSIM_POLICY_TYPE_BRRIP,
+    CSIM_POLICY_TYPE_OPT,
+    CSIM_POLICY_TYPE_COUNT,
+}CSIM_POLICY_TYPE;
+
+struct CSim_Cache_Policy {
+    const char * name;
+    /* set when victim selection needs the next-use index of the trace */
+    char need_future;
+    /* called on a hit and after a line is (re)filled, respectively */
+    void (*hit)(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+    void (*fill)(CSim_Cache * cache, CSim_Cache_Set * set, int index, const CSim_Access * access);
+    /* pick the line to evict from a full set */
+    int (*victim)(CSim_Cache * cache, CSim_Cache_Set * set);
+};
+
+/* sampling mode definition */
+typedef enum CSIM_SAMPLING_TYPE {
+    CSIM_SAMPLING_TYPE_NONE,
+    CSIM_SAMPLING_TYPE_SET,     /* simulate one set in set_ratio */
+    CSIM_SAMPLING_TYPE_TIME,    /* simulate a window of every period */
+}CSIM_SAMPLING_TYPE;
+
+/* sampled simulation definition */
+typedef struct CSim_Sampling {
+    CSIM_SAMPLING_TYPE type;
+    int set_ratio;
+    /* every period references: warmup simulated uncounted, then window counted */
+    uint64_t period;
+    uint64_t warmup;
+    uint64_t window;
+}CSim_Sampling;
+
+/* sampled simulation result, scaled to the whole trace */
+typedef struct CSim_Sample_Result {
+    CSim_Cache_Result estimate;
+    uint64_t references;        /* hits plus misses over the whole trace */
+    uint64_t sampled;           /* references counted in sampled sets or windows */
+    int units;                  /* sampled sets or windows */
+    double miss_ratio;
+    double miss_ratio_error;    /* half width of the 95% confidence interval */
+    /* full simulation alongside, when a second cache is given */
+    char has_full;
+    CSim_Cache_Result full;
+}CSim_Sample_Result;
+
+/* hardware prefetcher definition */
+typedef enum CSIM_PREFETCH_TYPE {
+    CSIM_PREFETCH_TYPE_NONE,
+    CSIM_PREFETCH_TYPE_NEXT,    /* next blocks on a miss or on first use of a prefetch */
+    CSIM_PREFETCH_TYPE_STRIDE,  /* blocks ahead along the stride of an instruction or page */
+    CSIM_PREFETCH_TYPE_STREAM,  /* stream buffers beside the cache, refilled as they are used */
+    CSIM_PREFETCH_TYPE_COUNT,
+}CSIM_PREFETCH_TYPE;
+
+/* most blocks prefetched ahead, and the size of the prefetcher tables */
+#define CSIM_PREFETCH_DEGREE_MAX 32
+#define CSIM_STRIDE_ENTRIES 64
+#define CSIM_STREAM_BUFFERS 4
+#define CSIM_STREAM_HISTORY 16
+#define CSIM_POLLUTION_ENTRIES 1024
+
+/* prefetch counters */
+typedef struct CSim_Prefetch_Result {
+    int issued;     /* blocks fetched from memory by the prefetcher */
+    int useful;     /* prefetched blocks later used by a demand access */
+    int late;       /* useful ones demanded before they arrived */
+    int unused;     /* prefetched blocks dropped before any use */
+    int polluting;  /* demand misses on blocks a prefetch evicted */
+}CSim_Prefetch_Result;
+
+/* stride table entry, for one instruction or, without one, one page */
+typedef struct CSim_Stride_Entry {
+    char valid;
+    uint64_t key;
+    uint64_t last_block;
+    int64_t stride;
+    int confidence;     /* times in a row the stride repeated */
+    uint64_t stamp;
+}CSim_Stride_Entry;
+
+/* stream buffer holding blocks [head, head + count) */
+typedef struct CSim_Stream_Buffer {
+    char valid;
+    uint64_t head;
+    int count;
+    uint64_t ready[CSIM_PREFETCH_DEGREE_MAX];   /* arrival clock by block modulo degree */
+    uint64_t stamp;
+}CSim_Stream_Buffer;
+
+/* line evicted by a prefetch, to catch the demand miss it causes */
+typedef struct CSim_Pollution_Entry {
+    char valid;
+    int set;
+    uint64_t tag;
+}CSim_Pollution_Entry;
+
+struct CSim_Prefetcher {
+    CSIM_PREFETCH_TYPE type;
+    int degree;     /* blocks prefetched ahead, or depth of each stream buffer */
+    int latency;    /* accesses a prefetch takes to arrive */
+    CSim_Prefetch_Result result;
+    CSim_Stride_Entry stride[CSIM_STRIDE_ENTRIES];
+    CSim_Stream_Buffer stream[CSIM_STREAM_BUFFERS];
+    uint64_t misses[CSIM_STREAM_HISTORY];   /* recent missing blocks plus one, 0 when empty */
+    int next_miss;
+    CSim_Pollution_Entry pollution[CSIM_POLLUTION_ENTRIES];
+};
+
+/* coherence protocol definition */
+typedef enum CSIM_PROTOCOL_TYPE {
+    CSIM_PROTOCOL_TYPE_MESI,
+    CSIM_PROTOCOL_TYPE_MOESI,
+    CSIM_PROTOCOL_TYPE_COUNT,
+}CSIM_PROTOCOL_TYPE;
+
+/* coherence state of a line, invalid lines also have valid_bit clear */
+typedef enum CSIM_COHERENCE_STATE {
+    CSIM_COHERENCE_STATE_INVALID,
+    CSIM_COHERENCE_STATE_SHARED,
+    CSIM_COHERENCE_STATE_EXCLUSIVE,
+    CSIM_COHERENCE_STATE_OWNED,
+    CSIM_COHERENCE_STATE_MODIFIED,
+}CSIM_COHERENCE_STATE;
+
+/* most cores of a system, and the hot blocks reported */
+#define CSIM_MAX_CORES 32
+#define CSIM_HOT_BLOCKS 10
+
+/* per-core result of a multi-core simulation */
+typedef struct CSim_Core_Result {
+    CSim_Cache_Result cache;
+    int coherence_miss;     /* misses on lines another core invalidated */
+    int true_sharing;       /* coherence misses touching bytes written since */
+    int false_sharing;      /* coherence misses touching only other bytes */
+    int invalidated;        /* lines of this core invalidated by others */
+    int invalidations;      /* lines of other cores this core invalidated */
+    int upgrades;           /* stores hitting shared or owned lines */
+    int transfers;          /* misses served by another core's dirty line */
+}CSim_Core_Result;
+
+/* sharing record of a block some core lost to an invalidation */
+typedef struct CSim_Sharing_Block {
+    char used;
+    uint64_t block;
+    uint32_t invalidated;               /* cores whose copy is invalidated and not refetched */
+    uint32_t cores;                     /* cores ever invalidated */
+    uint64_t written[CSIM_MAX_CORES];   /* 64ths of the block written since each core's invalidation */
+    int invalidations;
+    int true_sharing;
+    int false_sharing;
+}CSim_Sharing_Block;
+
+/* private caches of several cores kept coherent over a shared last-level cache */
+typedef struct CSim_System {
+    int cores;
+    CSIM_PROTOCOL_TYPE protocol;
+    int chunk_shift;    /* bytes per bit of a written mask, as a shift */
+    CSim_Cache * l1[CSIM_MAX_CORES];
+    CSim_Cache * llc;
+    CSim_Core_Result core[CSIM_MAX_CORES];
+    CSim_Cache_Result llc_result;
+    /* sharing records, open addressing on block number */
+    CSim_Sharing_Block * blocks;
+    size_t block_capacity;
+    size_t block_count;
+}CSim_System;
+
+/* error definition */
+typedef enum CSIM_ERROR {
+    CSIM_OK = 0,
+    CSIM_ERROR_INVALID_OPTION,
+    CSIM_ERROR_MISSING_ARGUMENT,
+    CSIM_ERROR_FILE_CANNOT_OPEN,
+    CSIM_ERROR_OUT_OF_MEMORY,
+}CSIM_ERROR;
+
+/* macro definition for get a value given mask and offset */
+#define csim_get_value(number, mask, offset) (((number) & (mask)) >> (offset))
+
+/* marks an access whose block is never referenced again */
+#define CSIM_NEVER ((uint64_t)-1)
+
+/* replacement policy table, indexed by CSIM_POLICY_TYPE */
+extern const CSim_Cache_Policy csim_policies[CSIM_POLICY_TYPE_COUNT];
+
+/* function list */
+/* replacement policy lookup by name, NULL when unknown */
+const CSim_Cache_Policy * csim_find_policy(const char * name);
+/* cache structure related functions */
+CSim_Cache * csim_construct_cache(int set_number, int line_number, int block_offset, const CSim_Cache_Policy * policy);
+void csim_deconstruct_cache(CSim_Cache ** pcache);
+int csim_count_dirty(CSim_Cache * cache);
+/* prefetcher related functions, CSIM_PREFETCH_TYPE_COUNT when the name is unknown */
+CSIM_PREFETCH_TYPE csim_find_prefetcher(const char * name);
+void csim_attach_prefetcher(CSim_Cache * cache, CSIM_PREFETCH_TYPE type, int degree, int latency);
+void csim_print_prefetch(CSim_Cache * cache);
+/* multi-core simulation functions, CSIM_PROTOCOL_TYPE_COUNT when the name is unknown */
+CSIM_PROTOCOL_TYPE csim_find_protocol(const char * name);
+CSim_System * csim_construct_system(int cores, CSIM_PROTOCOL_TYPE protocol, int set_number, int line_number, int block_offset, const CSim_Cache_Policy * policy, int llc_set_number, int llc_line_number);
+void csim_deconstruct_system(CSim_System ** psystem);
+void csim_access_system(CSim_System * system, const CSim_Access * access, char verbose_flag);
+void csim_print_system(CSim_System * system);
+/* trace related functions */
+int csim_read_access(CSim_Trace * trace, CSim_Access * access);
+CSim_Access * csim_load_trace(CSim_Trace * trace, size_t * pcount);
+void csim_build_next_use(CSim_Cache * cache, CSim_Access * accesses, size_t count);
+/* cache simulation functions */
+CSIM_OPERATION_RESULT csim_access_cache(CSim_Cache * cache, const CSim_Access * access, CSim_Cache_Result * summary, char verbose_flag);
+CSim_Cache_Result csim_parse_trace_file(CSim_Cache * cache, CSim_Trace * trace, char verbose_flag);
+CSim_Sample_Result csim_parse_trace_sampled(CSim_Cache * cache, CSim_Cache * full_cache, CSim_Trace * trace, const CSim_Sampling * sampling);
+void csim_print_sampling(const CSim_Sampling * sampling, const CSim_Sample_Result * result);
+void csim_print_traffic(CSim_Cache * cache, CSim_Cache_Result summary);
+
+#endif /* CSIM_H */
@@ -0,0 +1,62 @@
+/*
+ * instrument.c - ThreadSanitizer entry points that record accesses
+ *
+ * Only the hooks gcc emits for plain C code are provided; the real
+ * ThreadSanitizer runtime must not be linked in.
+ */
+#include <stddef.h>
+#include <stdint.h>
+#include "instrument.h"
+
+static instr_sink_t instr_sink = NULL;
+static void *instr_arg = NULL;
+static uintptr_t instr_stack_top = 0;
+
+void instr_start(instr_sink_t sink, void *arg, const void *stack_top)
+{
+    instr_arg = arg;
+    instr_stack_top = (uintptr_t)stack_top;
+    instr_sink = sink;
+}
+
+void instr_stop(void)
+{
+    instr_sink = NULL;
+}
+
+/*
+ * record - Forward an access unless it falls in the stack frames that
+ *     lie between this hook and the frame that started tracing
+ */
+static inline void record(char op, const void *addr, unsigned int size)
+{
+    uintptr_t address = (uintptr_t)addr;
+
+    if (instr_sink == NULL)
+        return;
+    if (address >= (uintptr_t)__builtin_frame_address(0) &&
+        address < instr_stack_top)
+        return;
+    instr_sink(instr_arg, op, address, size);
+}
+
+#define INSTR_HOOKS(size)                                               \
+    void __tsan_read##size(void *addr) { record('L', addr, size); }     \
+    void __tsan_write##size(void *addr) { record('S', addr, size); }    \
+    void __tsan_unaligned_read##size(void *addr) { record('L', addr, size); } \
+    void __tsan_unaligned_write##size(void *addr) { record('S', addr, size); }
+
+void __tsan_read1(void *addr) { record('L', addr, 1); }
+void __tsan_write1(void *addr) { record('S', addr, 1); }
+INSTR_HOOKS(2)
+INSTR_HOOKS(4)
+INSTR_HOOKS(8)
+INSTR_HOOKS(16)
+
+void __tsan_read_range(void *addr, size_t size) { record('L', addr, size); }
+void __tsan_write_range(void *addr, size_t size) { record('S', addr, size); }
+
+/* Function and initialization hooks carry no accesses */
+void __tsan_init(void) { }
+void __tsan_func_entry(void *pc) { }
+void __tsan_func_exit(void) { }
@@ -0,0 +1,31 @@
+/*
+ * instrument.h - Native memory tracing of the transpose functions
+ *
+ * trans.c is compiled a second time with -fsanitize=thread, which
+ * makes gcc call __tsan_readN/__tsan_writeN before every memory access
+ * that might be shared. Locals that never have their address taken are
+ * not instrumented, so what remains are exactly the A and B accesses
+ * that test-trans used to filter out of a valgrind lackey trace.
+ * instrument.c supplies those hooks in place of the ThreadSanitizer
+ * runtime and forwards each access to a sink.
+ */
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+/* Receives one access; op is 'L' or 'S' as in lackey traces */
+typedef void (*instr_sink_t)(void *arg, char op,
+                             unsigned long long address, unsigned int size);
+
+/*
+ * instr_start - Send accesses to sink from now on. Accesses to the
+ *     stack between the hook and stack_top (pass the caller's
+ *     __builtin_frame_address(0)) are dropped, like test-trans drops
+ *     stack accesses from lackey traces.
+ */
+void instr_start(instr_sink_t sink, void *arg, const void *stack_top);
+
+/* instr_stop - Stop tracing */
+void instr_stop(void);
+
+#endif /* INSTRUMENT_H */
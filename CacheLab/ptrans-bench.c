@@ -0,0 +1,140 @@
+/*
+ * ptrans-bench.c - Measures how the multithreaded transpose of ptrans.h
+ *     scales from one thread to every CPU
+ *
+ * For each thread count (powers of two, then the maximum) a fresh pool
+ * allocates A and B with first-touch placement, the transpose is
+ * checked once and then timed; the best of the repetitions is reported
+ * with its GB/s (A read once and B written once) and the speedup over
+ * one thread.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include "ptrans.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * run - Time the transpose on a pool of the given number of threads.
+ *     Returns the best time in seconds, or a negative value on failure.
+ */
+static double run(int threads, int M, int N, int reps)
+{
+    ptrans_pool_t *pool;
+    int *A, *B;
+    int i, j;
+    double start, elapsed, best = -1;
+
+    if ((pool = ptrans_create(threads)) == NULL) {
+        printf("Error: Cannot start %d threads\n", threads);
+        return -1;
+    }
+    if (!ptrans_alloc(pool, M, N, &A, &B)) {
+        printf("Error: Out of memory for %dx%d matrices\n", M, N);
+        ptrans_destroy(pool);
+        return -1;
+    }
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < M; j++)
+            A[(size_t)i * M + j] = i * 31 + j;
+    }
+
+    ptrans_transpose(pool, M, N, A, B);
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < M; j++) {
+            if (B[(size_t)j * N + i] != A[(size_t)i * M + j]) {
+                printf("Error: Wrong transpose at B[%d][%d]\n", j, i);
+                goto out;
+            }
+        }
+    }
+
+    for (i = 0; i < reps; i++) {
+        start = now();
+        ptrans_transpose(pool, M, N, A, B);
+        elapsed = now() - start;
+        if (best < 0 || elapsed < best)
+            best = elapsed;
+    }
+out:
+    ptrans_free(A);
+    ptrans_free(B);
+    ptrans_destroy(pool);
+    return best;
+}
+
+/*
+ * usage - Print usage info
+ */
+static void usage(char *argv[])
+{
+    printf("Usage: %s [-h] [-M <cols>] [-N <rows>] [-t <threads>] [-r <reps>]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -M <num>    Columns of A (default 8192).\n");
+    printf("  -N <num>    Rows of A (default 8192).\n");
+    printf("  -t <num>    Most threads to try (default: online CPUs).\n");
+    printf("  -r <num>    Timed repetitions per thread count (default 5).\n");
+    printf("Example: %s -M 20000 -N 20000\n", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    char c;
+    int M = 8192, N = 8192, reps = 5;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads;
+    double best, base = 0;
+
+    while ((c = getopt(argc, argv, "hM:N:t:r:")) != -1) {
+        switch (c) {
+        case 'M':
+            M = atoi(optarg);
+            break;
+        case 'N':
+            N = atoi(optarg);
+            break;
+        case 't':
+            max_threads = atoi(optarg);
+            break;
+        case 'r':
+            reps = atoi(optarg);
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+    if (M <= 0 || N <= 0 || reps <= 0 || max_threads <= 0) {
+        printf("Error: Arguments must be positive\n");
+        usage(argv);
+        exit(1);
+    }
+
+    printf("%dx%d ints, %.1f MB per matrix\n", M, N,
+           sizeof(int) * (double)M * N / 1e6);
+    for (threads = 1; ; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+        if ((best = run(threads, M, N, reps)) < 0)
+            exit(1);
+        if (threads == 1)
+            base = best;
+        printf("threads:%3d  best %9.3f ms  %6.2f GB/s  speedup %5.2fx\n",
+               threads, best * 1e3, 2.0 * sizeof(int) * M * N / best / 1e9,
+               base / best);
+        if (threads == max_threads)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,224 @@
+/*
+ * ptrans.c - Multithreaded transpose of large matrices (see ptrans.h)
+ *
+ * Thread i always owns band i: columns [c0, c1) of A and rows [c0, c1)
+ * of B, with c0 and c1 multiples of 8 so that bands split on whole
+ * tiles. Workers are pinned to one CPU each so the pages they first
+ * touch stay local to them.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "ptrans.h"
+
+/* Defined in trans.c */
+extern void transpose_simd_cols(int M, int N, int A[N][M], int B[M][N],
+                                int c0, int c1);
+
+/* Alignment of matrices, one page */
+#define PTRANS_ALIGN 4096
+
+typedef enum {
+    PTRANS_JOB_TOUCH,
+    PTRANS_JOB_TRANSPOSE
+} ptrans_job_t;
+
+typedef struct ptrans_worker {
+    ptrans_pool_t *pool;
+    int id;
+    pthread_t thread;
+} ptrans_worker_t;
+
+struct ptrans_pool {
+    int threads;
+    ptrans_worker_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;   /* bumped for every job */
+    int pending;                /* workers still busy with the job */
+    int stop;
+    /* current job */
+    ptrans_job_t job;
+    int M, N;
+    int *A, *B;
+};
+
+/*
+ * band - Columns [c0, c1) of A handled by thread id for width M
+ */
+static void band(const ptrans_pool_t *pool, int M, int id, int *c0, int *c1)
+{
+    int chunk = ((M + pool->threads - 1) / pool->threads + 7) / 8 * 8;
+
+    *c0 = (long)id * chunk < M ? id * chunk : M;
+    *c1 = M - *c0 > chunk ? *c0 + chunk : M;
+}
+
+/*
+ * run_band - Do thread id's share of the current job
+ */
+static void run_band(ptrans_pool_t *pool, int id)
+{
+    int M = pool->M, N = pool->N;
+    int c0, c1, r;
+
+    band(pool, M, id, &c0, &c1);
+    if (c0 == c1)
+        return;
+    switch (pool->job) {
+    case PTRANS_JOB_TOUCH:
+        for (r = 0; r < N; r++)
+            memset(pool->A + (size_t)r * M + c0, 0, sizeof(int) * (c1 - c0));
+        memset(pool->B + (size_t)c0 * N, 0, sizeof(int) * (c1 - c0) * (size_t)N);
+        break;
+    case PTRANS_JOB_TRANSPOSE:
+        transpose_simd_cols(M, N, (int (*)[M]) pool->A, (int (*)[N]) pool->B,
+                            c0, c1);
+        break;
+    }
+}
+
+/*
+ * worker - Wait for each new job, do this thread's band and report back
+ */
+static void *worker(void *arg)
+{
+    ptrans_worker_t *self = arg;
+    ptrans_pool_t *pool = self->pool;
+    unsigned long seen = 0;
+    cpu_set_t cpus;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpu > 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(self->id % ncpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_band(pool, self->id);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * dispatch - Run a job on every thread, the caller doing band 0
+ */
+static void dispatch(ptrans_pool_t *pool, ptrans_job_t job,
+                     int M, int N, int *A, int *B)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->M = M;
+    pool->N = N;
+    pool->A = A;
+    pool->B = B;
+    pool->pending = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_band(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+ptrans_pool_t *ptrans_create(int threads)
+{
+    ptrans_pool_t *pool;
+    int i;
+
+    if (threads < 1 || (pool = calloc(1, sizeof(*pool))) == NULL)
+        return NULL;
+    if ((pool->workers = calloc(threads, sizeof(*pool->workers))) == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pool->threads = threads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (i = 1; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].id = i;
+        if (pthread_create(&pool->workers[i].thread, NULL, worker,
+                           &pool->workers[i]) != 0) {
+            pool->threads = i;
+            ptrans_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void ptrans_destroy(ptrans_pool_t *pool)
+{
+    int i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 1; i < pool->threads; i++)
+        pthread_join(pool->workers[i].thread, NULL);
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool);
+}
+
+int ptrans_threads(const ptrans_pool_t *pool)
+{
+    return pool->threads;
+}
+
+int ptrans_alloc(ptrans_pool_t *pool, int M, int N, int **A, int **B)
+{
+    size_t bytes = sizeof(int) * (size_t)M * N;
+    void *a, *b;
+
+    /* Large allocations are fresh pages that nothing has touched yet */
+    if (posix_memalign(&a, PTRANS_ALIGN, bytes) != 0)
+        return 0;
+    if (posix_memalign(&b, PTRANS_ALIGN, bytes) != 0) {
+        free(a);
+        return 0;
+    }
+    dispatch(pool, PTRANS_JOB_TOUCH, M, N, a, b);
+    *A = a;
+    *B = b;
+    return 1;
+}
+
+void ptrans_free(int *matrix)
+{
+    free(matrix);
+}
+
+void ptrans_transpose(ptrans_pool_t *pool, int M, int N, const int *A, int *B)
+{
+    dispatch(pool, PTRANS_JOB_TRANSPOSE, M, N, (int *) A, B);
+}
@@ -0,0 +1,43 @@
+/*
+ * ptrans.h - Multithreaded transpose of large matrices
+ *
+ * A pool of threads splits B = A^T into bands of rows of B (columns of
+ * A), one per thread, each transposed with the SIMD tiles of trans.c.
+ * Matrices from ptrans_alloc() are first touched by the thread that
+ * later works on each band, so on a NUMA machine its pages land on
+ * that thread's node. As in trans.c, A has N rows of M ints and B has
+ * M rows of N ints.
+ */
+
+#ifndef PTRANS_H
+#define PTRANS_H
+
+typedef struct ptrans_pool ptrans_pool_t;
+
+/*
+ * ptrans_create - Start a pool of the given number of threads. The
+ *     calling thread does the first band itself, so threads - 1 are
+ *     created. Returns NULL on failure.
+ */
+ptrans_pool_t *ptrans_create(int threads);
+
+/* ptrans_destroy - Stop and join the threads of the pool */
+void ptrans_destroy(ptrans_pool_t *pool);
+
+/* ptrans_threads - Number of threads working on each transpose */
+int ptrans_threads(const ptrans_pool_t *pool);
+
+/*
+ * ptrans_alloc - Allocate zeroed A and B for an M x N transpose, each
+ *     band first touched by the thread that transposes it. Returns 0
+ *     if out of memory. Release them with ptrans_free().
+ */
+int ptrans_alloc(ptrans_pool_t *pool, int M, int N, int **A, int **B);
+
+/* ptrans_free - Release a matrix from ptrans_alloc() */
+void ptrans_free(int *matrix);
+
+/* ptrans_transpose - B = A^T using every thread of the pool */
+void ptrans_transpose(ptrans_pool_t *pool, int M, int N, const int *A, int *B);
+
+#endif /* PTRANS_H */
@@ -2,7 +2,14 @@
  * test-trans.c - Checks the correctness and performance of all of the
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
+ *
+ * With -j, the functions are evaluated by that many worker processes at
+ * once. Each worker collects its output in a temporary file and, when
+ * tracing under valgrind, runs in a private directory so trace.tmp,
+ * .marker and .csim_results do not collide. The outputs are printed in
+ * function order once every worker is done.
  */
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,6 +19,9 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
+#include "bintrace.h"
+#include "csim.h"
+#include "instrument.h"
 #include <sys/wait.h> // fir WEXITSTATUS
 #include <limits.h> // for INT_MAX
 
@@ -32,6 +42,20 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static int use_lackey = 0; /* trace with valgrind and simulate with csim-ref */
+static int timing = 0;     /* also time the functions natively */
+static int analyse = 0;    /* classify misses and print heatmaps */
+static int jobs = 1;       /* functions evaluated at once */
+
+/* Directory holding tracegen and csim-ref, absolute with -j */
+static char tool_dir[PATH_MAX] = ".";
+
+/* Matrices for in-process evaluation */
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+
+/* Markers bounding the trace of each function, as in tracegen */
+volatile char MARKER_START, MARKER_END;
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,132 +65,571 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
-/* 
- * eval_perf - Evaluate the performance of the registered transpose functions
+/*
+ * read_trace_record - Read the next access from a trace that is either
+ *     lackey text or, when bin is not NULL, a binary trace
  */
-void eval_perf(unsigned int s, unsigned int E, unsigned int b)
+static int read_trace_record(FILE *fp, bintrace_t *bin, bintrace_record_t *record)
+{
+    char buf[1000];
+
+    if (bin != NULL)
+        return bintrace_read(bin, record);
+    while (fgets(buf, 1000, fp) != NULL) {
+        if (bintrace_parse_text(buf, record))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * validate - Check B against the baseline transpose of A
+ */
+static int validate(int M, int N, int A[N][M], int B[M][N])
+{
+    int C[M][N];
+    memset(C, 0, sizeof(C));
+    correctTrans(M, N, A, C);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            if (B[i][j] != C[i][j])
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Miss classes of -a */
+enum { MISS_COMPULSORY, MISS_CAPACITY, MISS_CONFLICT, MISS_CLASSES };
+static const char* miss_class_names[MISS_CLASSES] = {"compulsory", "capacity", "conflict"};
+
+/*
+ * Miss analysis of -a. A miss is compulsory on the first touch of a
+ * block, a capacity miss if a fully associative LRU cache of the same
+ * size misses too, and a conflict miss otherwise.
+ */
+typedef struct {
+    CSim_Cache* shadow;
+    CSim_Cache_Result shadow_summary;
+    unsigned int s, b;
+    /* blocks touched so far, open addressing on block number + 1 */
+    unsigned long long* seen;
+    size_t seen_size, seen_count;
+    int misses[MISS_CLASSES];
+    int (*set_misses)[MISS_CLASSES];
+    /* misses per element of A (N x M) and B (M x N) */
+    int* a_misses;
+    int* b_misses;
+} analysis_t;
+
+/* State of an in-process simulation, handed to the instrumentation sink */
+typedef struct {
+    CSim_Cache* cache;
+    CSim_Cache_Result summary;
+    analysis_t* analysis;   /* NULL unless analysing misses */
+} sim_state_t;
+
+/*
+ * analysis_create - Set up miss analysis for an M x N transpose on a
+ *     cache with 2^s sets of E lines of 2^b bytes
+ */
+static analysis_t* analysis_create(unsigned int s, unsigned int E, unsigned int b)
+{
+    analysis_t* an = calloc(1, sizeof(analysis_t));
+    assert(an);
+    an->shadow = csim_construct_cache(0, E << s, b, &csim_policies[CSIM_POLICY_TYPE_LRU]);
+    an->s = s;
+    an->b = b;
+    an->seen_size = 1024;
+    an->seen = calloc(an->seen_size, sizeof(unsigned long long));
+    an->set_misses = calloc(1 << s, sizeof(*an->set_misses));
+    an->a_misses = calloc(M * N, sizeof(int));
+    an->b_misses = calloc(M * N, sizeof(int));
+    assert(an->seen && an->set_misses && an->a_misses && an->b_misses);
+    return an;
+}
+
+static void analysis_free(analysis_t* an)
+{
+    csim_deconstruct_cache(&an->shadow);
+    free(an->seen);
+    free(an->set_misses);
+    free(an->a_misses);
+    free(an->b_misses);
+    free(an);
+}
+
+/*
+ * analysis_touch - Remember block as touched; returns 1 the first time
+ */
+static int analysis_touch(analysis_t* an, unsigned long long block)
+{
+    size_t i, mask = an->seen_size - 1;
+    unsigned long long key = block + 1;
+    unsigned long long* old;
+    size_t old_size;
+
+    for (i = (key * 0x9E3779B97F4A7C15ULL) >> 32 & mask; an->seen[i] != 0; i = (i + 1) & mask) {
+        if (an->seen[i] == key)
+            return 0;
+    }
+    an->seen[i] = key;
+    if (++an->seen_count * 2 > an->seen_size) {
+        old = an->seen;
+        old_size = an->seen_size;
+        an->seen_size *= 2;
+        an->seen = calloc(an->seen_size, sizeof(unsigned long long));
+        assert(an->seen);
+        an->seen_count = 0;
+        for (i = 0; i < old_size; i++) {
+            if (old[i] != 0)
+                analysis_touch(an, old[i] - 1);
+        }
+        free(old);
+    }
+    return 1;
+}
+
+/*
+ * analysis_access - Classify one access, given whether the cache missed
+ */
+static void analysis_access(analysis_t* an, const CSim_Access* access,
+                            unsigned long long address, int miss)
+{
+    unsigned long long block = address >> an->b;
+    int first = analysis_touch(an, block);
+    int shadow_miss = csim_access_cache(an->shadow, access, &an->shadow_summary, 0)
+                      != CSIM_OPERATION_RESULT_HIT;
+    int class;
+    unsigned long long a = (unsigned long long) &A[0][0];
+    unsigned long long b = (unsigned long long) &B[0][0];
+
+    if (!miss)
+        return;
+    class = first ? MISS_COMPULSORY : shadow_miss ? MISS_CAPACITY : MISS_CONFLICT;
+    an->misses[class]++;
+    an->set_misses[block & ((1 << an->s) - 1)][class]++;
+    if (address >= a && address < a + sizeof(int) * M * N)
+        an->a_misses[(address - a) / sizeof(int)]++;
+    else if (address >= b && address < b + sizeof(int) * M * N)
+        an->b_misses[(address - b) / sizeof(int)]++;
+}
+
+/*
+ * print_heatmap - One line per row of a rows x cols matrix with a
+ *     character per element (. for no misses, 1-9, + for more) and the
+ *     row total, then the column totals
+ */
+static void print_heatmap(const char* name, int rows, int cols, const int* misses)
+{
+    int i, j, n, total;
+
+    printf("  %s misses, %d rows x %d columns:\n", name, rows, cols);
+    for (i = 0; i < rows; i++) {
+        printf("  %3d |", i);
+        for (total = 0, j = 0; j < cols; j++) {
+            n = misses[i * cols + j];
+            total += n;
+            putchar(n == 0 ? '.' : n > 9 ? '+' : '0' + n);
+        }
+        printf("| %d\n", total);
+    }
+    printf("  column totals:");
+    for (j = 0; j < cols; j++) {
+        for (total = 0, i = 0; i < rows; i++)
+            total += misses[i * cols + j];
+        printf(" %d", total);
+    }
+    printf("\n");
+}
+
+/*
+ * print_analysis - Report the miss classes overall and per set, and the
+ *     heatmaps of A and B
+ */
+static void print_analysis(const analysis_t* an)
 {
-    int i,flag;
-    unsigned int len, hits, misses, evictions;
+    int i, set;
+
+    printf("  misses by class:");
+    for (i = 0; i < MISS_CLASSES; i++)
+        printf(" %s:%d", miss_class_names[i], an->misses[i]);
+    printf("\n  %5s %8s %11s %9s %9s\n", "set", "misses",
+           miss_class_names[0], miss_class_names[1], miss_class_names[2]);
+    for (set = 0; set < 1 << an->s; set++) {
+        printf("  %5d %8d %11d %9d %9d\n", set,
+               an->set_misses[set][0] + an->set_misses[set][1] + an->set_misses[set][2],
+               an->set_misses[set][0], an->set_misses[set][1], an->set_misses[set][2]);
+    }
+    print_heatmap("A", N, M, an->a_misses);
+    print_heatmap("B", M, N, an->b_misses);
+}
+
+/*
+ * sim_access - Instrumentation sink feeding the simulated cache
+ */
+static void sim_access(void* arg, char op, unsigned long long address,
+                       unsigned int size)
+{
+    sim_state_t* state = arg;
+    CSim_Access access;
+    CSIM_OPERATION_RESULT result;
+
+    access.type = op == 'L' ? CSIM_OPERATION_TYPE_LOAD :
+                  op == 'S' ? CSIM_OPERATION_TYPE_STORE :
+                  CSIM_OPERATION_TYPE_MODIFY;
+    access.address = address;
+    access.size = size;
+    access.next_use = CSIM_NEVER;
+    access.pc = 0;
+    access.thread = 0;
+    result = csim_access_cache(state->cache, &access, &state->summary, 0);
+    if (state->analysis != NULL)
+        analysis_access(state->analysis, &access, address,
+                        result != CSIM_OPERATION_RESULT_HIT);
+}
+
+/*
+ * eval_native - Run function i on the instrumented trans.c, feeding its
+ *     accesses straight into the cache simulator, and into analysis too
+ *     unless it is NULL. Returns 0 if the function does not transpose
+ *     correctly.
+ */
+static int eval_native(int i, unsigned int s, unsigned int E, unsigned int b,
+                       CSim_Cache_Result* summary, analysis_t* analysis)
+{
+    sim_state_t state;
+
+    state.analysis = analysis;
+    state.cache = csim_construct_cache(s, E, b, &csim_policies[CSIM_POLICY_TYPE_LRU]);
+    memset(&state.summary, 0, sizeof(state.summary));
+    initMatrix(M, N, A, B);
+
+    /* Harness accesses lackey sees around the call in tracegen */
+    MARKER_START = 33;
+    sim_access(&state, 'S', (unsigned long long) &MARKER_START, 1);
+    sim_access(&state, 'L', (unsigned long long) &func_list[i].func_ptr,
+               sizeof(func_list[i].func_ptr));
+    sim_access(&state, 'L', (unsigned long long) &N, sizeof(N));
+    sim_access(&state, 'L', (unsigned long long) &M, sizeof(M));
+    instr_start(sim_access, &state, __builtin_frame_address(0));
+    (*func_list[i].func_ptr)(M, N, A, B);
+    instr_stop();
+    sim_access(&state, 'S', (unsigned long long) &MARKER_END, 1);
+    MARKER_END = 34;
+
+    csim_deconstruct_cache(&state.cache);
+    *summary = state.summary;
+    return validate(M, N, A, B);
+}
+
+/*
+ * eval_lackey - Trace function i under valgrind and simulate it with the
+ *     reference simulator, as the original handout does. Returns 0 if
+ *     the function does not transpose correctly.
+ */
+static int eval_lackey(int i, unsigned int s, unsigned int E, unsigned int b,
+                       CSim_Cache_Result* summary)
+{
+    int flag;
+    unsigned int hits, misses, evictions;
     unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
+    char cmd[PATH_MAX + 255];
+    bintrace_record_t record;
     char filename[128];
 
-    registerFunctions(); 
-
     /* Open the complete trace file */
     FILE* full_trace_fp;  
     FILE* part_trace_fp; 
+    bintrace_t* full_trace_bin;
+
+    /* Use valgrind to generate the trace */
+    sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v %s/tracegen -M %d -N %d -F %d  > trace.tmp", tool_dir, M, N,i);
+    flag=WEXITSTATUS(system(cmd));
+    if (0!=flag)
+        return 0;
+
+    /* Get the start and end marker addresses */
+    FILE* marker_fp = fopen(".marker", "r");
+    assert(marker_fp);
+    fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
+    fclose(marker_fp);
+
+    full_trace_fp = fopen("trace.tmp", "r");
+    assert(full_trace_fp);
+    full_trace_bin = bintrace_open_read(full_trace_fp);
+
+    /* Filtered trace for each transpose function goes in a separate file */
+    sprintf(filename, "trace.f%d", i);
+    part_trace_fp = fopen(filename, "w");
+    assert(part_trace_fp);
+    
+    /* Locate trace corresponding to the trans function */
+    flag = 0;
+    while (read_trace_record(full_trace_fp, full_trace_bin, &record)) {
 
-    /* Evaluate the performance of each registered transpose function */
+        /* We are only interested in memory access instructions */
+        if (record.op != 'I') {
+            addr = record.address;
+        
+            /* If start marker found, set flag */
+            if (addr == marker_start)
+                flag = 1;
+
+            /* Valgrind creates many spurious accesses to the
+               stack that have nothing to do with the students
+               code. At the moment, we are ignoring all stack
+               accesses by using the simple filter of recording
+               accesses to only the low 32-bit portion of the
+               address space. At some point it would be nice to
+               try to do more informed filtering so that would
+               eliminate the valgrind stack references while
+               include the student stack references. */
+            if (flag && addr < 0xffffffff) {
+                bintrace_print_text(part_trace_fp, &record);
+            }
 
-    for (i=0; i<func_counter; i++) {
-        if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
-            results.funcid = i; /* remember which function is the submission */
+            /* if end marker found, close trace file */
+            if (addr == marker_end) {
+                flag = 0;
+                fclose(part_trace_fp);
+                break;
+            }
+        }
+    }
+    if (full_trace_bin != NULL)
+        bintrace_close(full_trace_bin);
+    fclose(full_trace_fp);
+
+    /* Run the reference simulator */
+    printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
+    sprintf(cmd, "%s/csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
+            tool_dir, s, E, b, i);
+    system(cmd);
+    
+    /* Collect results from the reference simulator */
+    FILE* in_fp = fopen(".csim_results","r");
+    assert(in_fp);
+    fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
+    fclose(in_fp);
+    summary->hit = hits;
+    summary->miss = misses;
+    summary->evict = evictions;
+    return 1;
+}
 
+/* What evaluating one function found */
+typedef struct {
+    int correct;
+    CSim_Cache_Result summary;
+} outcome_t;
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
-        /* Use valgrind to generate the trace */
+/*
+ * eval_function - Evaluate function i and print its report
+ */
+static void eval_function(int i, unsigned int s, unsigned int E, unsigned int b,
+                          outcome_t* outcome)
+{
+    analysis_t* analysis = NULL;
+    CSim_Cache_Result* summary = &outcome->summary;
+
+    printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
+    memset(outcome, 0, sizeof(*outcome));
+    if (analyse)
+        analysis = analysis_create(s, E, b);
+    if (use_lackey)
+        outcome->correct = eval_lackey(i, s, E, b, summary);
+    else
+        outcome->correct = eval_native(i, s, E, b, summary, analysis);
+    if (!outcome->correct) {
+        if (analysis != NULL)
+            analysis_free(analysis);
+        printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",i,M,N,i);      
+        return;
+    }
 
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
-        if (0!=flag) {
-            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
-            continue;
-        }
+    printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
+           i, func_list[i].description, summary->hit, summary->miss, summary->evict);
+    if (analysis != NULL) {
+        print_analysis(analysis);
+        analysis_free(analysis);
+    }
+}
 
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
+/*
+ * record_function - Save the outcome of function i, and of the
+ *     submission if it is the one
+ */
+static void record_function(int i, const outcome_t* outcome)
+{
+    if (strcmp(func_list[i].description, SUBMIT_DESCRIPTION) == 0 )
+        results.funcid = i; /* remember which function is the submission */
 
+    if (!outcome->correct)
+        return;
 
-        func_list[i].correct=1;
+    func_list[i].correct=1;
 
-        /* Save the correctness of the transpose submission */
-        if (results.funcid == i ) {
-            results.correct = 1;
-        }
+    /* Save the correctness of the transpose submission */
+    if (results.funcid == i ) {
+        results.correct = 1;
+    }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
+    func_list[i].num_hits = outcome->summary.hit;
+    func_list[i].num_misses = outcome->summary.miss;
+    func_list[i].num_evictions = outcome->summary.evict;
 
+    /* If it is transpose_submit(), record number of misses */
+    if (results.funcid == i) {
+        results.misses = outcome->summary.miss;
+    }
+}
 
-        /* Filtered trace for each transpose function goes in a separate file */
+/*
+ * worker - Body of the worker process for function i: evaluate it with
+ *     stdout going to out and send the outcome down result_fd
+ */
+static void worker(int i, unsigned int s, unsigned int E, unsigned int b,
+                   FILE* out, int result_fd)
+{
+    char dir[] = ".test-trans.XXXXXX";
+    char filename[128], target[PATH_MAX + 128];
+    outcome_t outcome;
+
+    dup2(fileno(out), STDOUT_FILENO);
+    if (use_lackey) {
+        /* Trace in a private directory, keeping only trace.f<i> */
+        if (mkdtemp(dir) == NULL || chdir(dir) != 0) {
+            printf("Error: Cannot create a working directory for function %d\n", i);
+            exit(1);
+        }
+    }
+    eval_function(i, s, E, b, &outcome);
+    if (use_lackey) {
         sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
-    
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
-        
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
-                }
-
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
+        sprintf(target, "%s/%s", tool_dir, filename);
+        rename(filename, target);
+        unlink("trace.tmp");
+        unlink(".marker");
+        unlink(".csim_results");
+        if (chdir(tool_dir) == 0)
+            rmdir(dir);
+    }
+    fflush(stdout);
+    if (write(result_fd, &outcome, sizeof(outcome)) != sizeof(outcome))
+        exit(1);
+    exit(0);
+}
+
+/*
+ * eval_parallel - Evaluate the registered functions with up to jobs
+ *     worker processes, then print their reports in order. A worker
+ *     that dies (a segfault in a transpose, say) ends the test as it
+ *     would have without -j.
+ */
+static void eval_parallel(unsigned int s, unsigned int E, unsigned int b)
+{
+    FILE* out[MAX_TRANS_FUNCS];
+    int result_fd[MAX_TRANS_FUNCS];
+    int fds[2], next = 0, running = 0, i, c;
+    pid_t pid;
+    outcome_t outcome;
+
+    if (getcwd(tool_dir, sizeof(tool_dir)) == NULL) {
+        printf("Error: Cannot get the working directory\n");
+        exit(1);
+    }
+
+    while (next < func_counter || running > 0) {
+        if (next < func_counter && running < jobs) {
+            out[next] = tmpfile();
+            if (out[next] == NULL || pipe(fds) != 0) {
+                printf("Error: Cannot start a worker for function %d\n", next);
+                exit(1);
             }
+            fflush(stdout);
+            if ((pid = fork()) < 0) {
+                printf("Error: Cannot start a worker for function %d\n", next);
+                exit(1);
+            }
+            if (pid == 0) {
+                close(fds[0]);
+                worker(next, s, E, b, out[next], fds[1]);
+            }
+            close(fds[1]);
+            result_fd[next] = fds[0];
+            next++;
+            running++;
+        } else {
+            wait(NULL);
+            running--;
         }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
-        printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
-               i, func_list[i].description, hits, misses, evictions);
-    
-        /* If it is transpose_submit(), record number of misses */
-        if (results.funcid == i) {
-            results.misses = misses;
+    }
+
+    for (i = 0; i < func_counter; i++) {
+        rewind(out[i]);
+        while ((c = getc(out[i])) != EOF)
+            putchar(c);
+        fclose(out[i]);
+        if (read(result_fd[i], &outcome, sizeof(outcome)) != sizeof(outcome)) {
+            fflush(stdout);
+            exit(1);
         }
+        close(result_fd[i]);
+        record_function(i, &outcome);
+    }
+}
+
+/* 
+ * eval_perf - Evaluate the performance of the registered transpose functions
+ */
+void eval_perf(unsigned int s, unsigned int E, unsigned int b)
+{
+    int i;
+    outcome_t outcome;
+
+    registerFunctions(); 
+
+    /* Evaluate the performance of each registered transpose function */
+
+    if (jobs > 1) {
+        eval_parallel(s, E, b);
+        return;
+    }
+    for (i=0; i<func_counter; i++) {
+        eval_function(i, s, E, b, &outcome);
+        record_function(i, &outcome);
     }
   
 }
 
+/*
+ * eval_timing - Time the registered functions natively with the
+ *     optimised build of trans.c in tracegen-bench
+ */
+void eval_timing(void)
+{
+    char cmd[255];
+
+    printf("\n");
+    fflush(stdout);
+    sprintf(cmd, "./tracegen-bench -T -M %d -N %d", M, N);
+    system(cmd);
+}
+
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-ahLT] [-j <jobs>] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
+    printf("  -a          Classify misses as compulsory, capacity or conflict and\n");
+    printf("              print them per cache set and per element of A and B.\n");
     printf("  -h          Print this help message.\n");
+    printf("  -j <num>    Evaluate this many functions at once.\n");
+    printf("  -L          Trace with valgrind lackey and simulate with csim-ref.\n");
+    printf("  -T          Also time the functions natively and report GB/s;\n");
+    printf("              larger matrices are then timed without simulation.\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
@@ -199,7 +662,7 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:j:ahLT")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +670,18 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 'L':
+            use_lackey = 1;
+            break;
+        case 'T':
+            timing = 1;
+            break;
+        case 'a':
+            analyse = 1;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            break;
         case 'h':
             usage(argv);
             exit(0);
@@ -216,12 +691,23 @@ int main(int argc, char* argv[])
         }
     }
   
+    if (analyse && use_lackey) {
+        printf("Error: -a needs the in-process simulation, drop -L\n");
+        exit(1);
+    }
+
     if (M == 0 || N == 0) {
         printf("Error: Missing required argument\n");
         usage(argv);
         exit(1);
     }
 
+    if ((M > MAXN || N > MAXN) && timing) {
+        printf("M or N exceeds %d, timing without simulation\n", MAXN);
+        eval_timing();
+        return 0;
+    }
+
     if (M > MAXN || N > MAXN) {
         printf("Error: M or N exceeds %d\n", MAXN);
         usage(argv);
@@ -244,6 +730,8 @@ int main(int argc, char* argv[])
 
     /* Check the performance of the student's transpose function */
     eval_perf(5, 1, 5);
+    if (timing)
+        eval_timing();
   
     /* Emit the results for this particular test */
     if (results.funcid == -1) {
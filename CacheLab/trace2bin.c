@@ -0,0 +1,113 @@
+/*
+ * trace2bin.c - Converts valgrind lackey text traces to the compact
+ *     binary trace format of bintrace.h, and back.
+ *
+ * Lines of the text trace that are not memory accesses (valgrind's
+ * "==pid==" chatter, for instance) are dropped during conversion.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include "bintrace.h"
+
+/*
+ * usage - Print usage info
+ */
+static void usage(char *argv[])
+{
+    printf("Usage: %s [-hdz] -i <infile> -o <outfile>\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -d          Decode a binary trace back to lackey text.\n");
+    printf("  -z          LZ compress the blocks of the binary trace.\n");
+    printf("  -i <file>   Input trace.\n");
+    printf("  -o <file>   Output trace.\n");
+    printf("Example: %s -z -i traces/long.trace -o long.bin\n", argv[0]);
+}
+
+static long long file_size(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    char c;
+    int decode = 0, flags = 0;
+    char *in_path = NULL, *out_path = NULL;
+    FILE *in_fp, *out_fp;
+    bintrace_t *trace;
+    bintrace_record_t record;
+    unsigned long long records = 0;
+
+    while ((c = getopt(argc, argv, "hdzi:o:")) != -1) {
+        switch (c) {
+        case 'd':
+            decode = 1;
+            break;
+        case 'z':
+            flags |= BINTRACE_FLAG_LZ;
+            break;
+        case 'i':
+            in_path = optarg;
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (in_path == NULL || out_path == NULL) {
+        printf("Error: Missing required argument\n");
+        usage(argv);
+        exit(1);
+    }
+
+    if ((in_fp = fopen(in_path, decode ? "rb" : "r")) == NULL) {
+        printf("Error: Cannot open %s\n", in_path);
+        exit(1);
+    }
+    if ((out_fp = fopen(out_path, decode ? "w" : "wb")) == NULL) {
+        printf("Error: Cannot open %s\n", out_path);
+        exit(1);
+    }
+
+    if (decode) {
+        if ((trace = bintrace_open_read(in_fp)) == NULL) {
+            printf("Error: %s is not a binary trace\n", in_path);
+            exit(1);
+        }
+        while (bintrace_read(trace, &record)) {
+            bintrace_print_text(out_fp, &record);
+            records++;
+        }
+    } else {
+        char buf[1000];
+        if ((trace = bintrace_open_write(out_fp, flags)) == NULL) {
+            printf("Error: Out of memory\n");
+            exit(1);
+        }
+        while (fgets(buf, sizeof(buf), in_fp) != NULL) {
+            if (bintrace_parse_text(buf, &record)) {
+                bintrace_write(trace, &record);
+                records++;
+            }
+        }
+    }
+    bintrace_close(trace);
+    fclose(in_fp);
+    fclose(out_fp);
+
+    printf("%llu records, %lld bytes in, %lld bytes out\n",
+           records, file_size(in_path), file_size(out_path));
+    return 0;
+}
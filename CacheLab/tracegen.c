@@ -5,8 +5,17 @@
  * The beginning and end of each registered transpose function's trace
  * is indicated by reading from "marker" addresses. These two marker
  * addresses are recorded in file for later use.
+ *
+ * Built with -DNATIVE_TRACE and linked against a copy of trans.c
+ * compiled with -fsanitize=thread (see instrument.h), tracegen-native
+ * records the same trace by itself with -t, without valgrind.
+ *
+ * With -T, the functions are timed natively on heap matrices of any
+ * size instead; tracegen-bench links an optimised, uninstrumented
+ * build of trans.c for this.
  */
 
+#define _POSIX_C_SOURCE 200809L
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
@@ -14,6 +23,11 @@
 #include <getopt.h>
 #include "cachelab.h"
 #include <string.h>
+#include <time.h>
+#ifdef NATIVE_TRACE
+#include "instrument.h"
+#include "bintrace.h"
+#endif
 
 /* External variables declared in cachelab.c */
 extern trans_func_t func_list[MAX_TRANS_FUNCS];
@@ -30,6 +44,52 @@ static int B[256][256];
 static int M;
 static int N;
 
+#ifdef NATIVE_TRACE
+/* Binary trace written with -t */
+static bintrace_t* trace_out = NULL;
+
+/* trace_access - Instrumentation sink appending to the binary trace */
+static void trace_access(void* arg, char op, unsigned long long address,
+                         unsigned int size) {
+    bintrace_record_t record = {op, address, size};
+    bintrace_write(trace_out, &record);
+}
+
+/* trace_harness - Record an access main makes that lackey would see */
+static void trace_harness(char op, volatile const void* address,
+                          unsigned int size) {
+    bintrace_record_t record = {op, (unsigned long long) address, size};
+    bintrace_write(trace_out, &record);
+}
+
+/*
+ * trace_begin - Besides the marker store, lackey sees main load the
+ *     function pointer, N and M (in that order) before the call
+ */
+static void trace_begin(int fn, const void* stack_top) {
+    if (trace_out) {
+        trace_harness('S', &MARKER_START, 1);
+        trace_harness('L', &func_list[fn].func_ptr, sizeof(func_list[fn].func_ptr));
+        trace_harness('L', &N, sizeof(N));
+        trace_harness('L', &M, sizeof(M));
+        instr_start(trace_access, NULL, stack_top);
+    }
+}
+
+static void trace_end() {
+    if (trace_out) {
+        instr_stop();
+        trace_harness('S', &MARKER_END, 1);
+    }
+}
+
+#define TRACE_BEGIN(fn) trace_begin(fn, __builtin_frame_address(0))
+#define TRACE_END() trace_end()
+#else
+#define TRACE_BEGIN(fn)
+#define TRACE_END()
+#endif
+
 
 int validate(int fn,int M, int N, int A[N][M], int B[M][N]) {
     int C[M][N];
@@ -46,12 +106,65 @@ int validate(int fn,int M, int N, int A[N][M], int B[M][N]) {
     return 1;
 }
 
+/* Minimum time spent timing each function with -T, in seconds */
+#define TIME_BUDGET 0.2
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * time_function - Time function fn natively on heap matrices, reporting
+ *     the fastest of at least three calls. Every call reads A and writes
+ *     B once, so 2*M*N*sizeof(int) bytes move per call. Returns 0 if the
+ *     function does not transpose correctly.
+ */
+static int time_function(int fn) {
+    int i, j, calls;
+    double start, elapsed, best = 0, total = 0;
+    int (*a)[M] = malloc(sizeof(int) * M * N);
+    int (*b)[N] = malloc(sizeof(int) * M * N);
+
+    assert(a && b);
+    initMatrix(M, N, a, b);
+    (*func_list[fn].func_ptr)(M, N, a, b);
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < M; j++) {
+            if (b[j][i] != a[i][j]) {
+                printf("Validation failed on function %d at B[%d][%d], not timed\n", fn, j, i);
+                free(a);
+                free(b);
+                return 0;
+            }
+        }
+    }
+
+    for (calls = 0; calls < 3 || total < TIME_BUDGET; calls++) {
+        start = now();
+        (*func_list[fn].func_ptr)(M, N, a, b);
+        elapsed = now() - start;
+        if (calls == 0 || elapsed < best)
+            best = elapsed;
+        total += elapsed;
+    }
+    printf("func %d (%s): %d calls, best %.3f ms, %.2f GB/s\n", fn,
+           func_list[fn].description, calls, best * 1e3,
+           2.0 * sizeof(int) * M * N / best / 1e9);
+    free(a);
+    free(b);
+    return 1;
+}
+
 int main(int argc, char* argv[]){
     int i;
 
     char c;
     int selectedFunc=-1;
-    while( (c=getopt(argc,argv,"M:N:F:")) != -1){
+    char* trace_file=NULL;
+    int timing=0;
+    while( (c=getopt(argc,argv,"M:N:F:t:T")) != -1){
         switch(c){
         case 'M':
             M = atoi(optarg);
@@ -62,6 +175,12 @@ int main(int argc, char* argv[]){
         case 'F':
             selectedFunc = atoi(optarg);
             break;
+        case 't':
+            trace_file = optarg;
+            break;
+        case 'T':
+            timing = 1;
+            break;
         case '?':
         default:
             printf("./tracegen failed to parse its options.\n");
@@ -70,9 +189,38 @@ int main(int argc, char* argv[]){
     }
   
 
+#ifdef NATIVE_TRACE
+    FILE* trace_fp = NULL;
+    if (trace_file) {
+        trace_fp = fopen(trace_file, "wb");
+        assert(trace_fp);
+        trace_out = bintrace_open_write(trace_fp, 0);
+        assert(trace_out);
+    }
+#else
+    if (trace_file) {
+        printf("./tracegen was built without native tracing, use ./tracegen-native.\n");
+        exit(1);
+    }
+#endif
+
     /*  Register transpose functions */
     registerFunctions();
 
+    if (timing) {
+        printf("Timing natively on %dx%d matrices\n", M, N);
+        for (i=0; i < func_counter; i++) {
+            if (-1==selectedFunc || i==selectedFunc)
+                time_function(i);
+        }
+        return 0;
+    }
+
+    if (M > 256 || N > 256) {
+        printf("./tracegen only traces matrices up to 256x256.\n");
+        exit(1);
+    }
+
     /* Fill A with data */
     initMatrix(M,N, A, B); 
 
@@ -88,19 +236,29 @@ int main(int argc, char* argv[]){
         /* Invoke registered transpose functions */
         for (i=0; i < func_counter; i++) {
             MARKER_START = 33;
+            TRACE_BEGIN(i);
             (*func_list[i].func_ptr)(M, N, A, B);
+            TRACE_END();
             MARKER_END = 34;
             if (!validate(i,M,N,A,B))
                 return i+1;
         }
     } else {
         MARKER_START = 33;
+        TRACE_BEGIN(selectedFunc);
         (*func_list[selectedFunc].func_ptr)(M, N, A, B);
+        TRACE_END();
         MARKER_END = 34;
         if (!validate(selectedFunc,M,N,A,B))
             return selectedFunc+1;
 
     }
+#ifdef NATIVE_TRACE
+    if (trace_out) {
+        bintrace_close(trace_out);
+        fclose(trace_fp);
+    }
+#endif
     return 0;
 }
 
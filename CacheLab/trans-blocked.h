@@ -0,0 +1,101 @@
+/*
+ * trans-blocked.h - The blocked transpose of trans-tune.h, as a template
+ *
+ * Define TRANS_BLOCKED_NAME, TRANS_BLOCKED_ARGS (extra parameters, each
+ * after a comma, or nothing) and TRANS_BLOCK_W, TRANS_BLOCK_H,
+ * TRANS_COL_MAJOR, TRANS_DIAG and TRANS_BUFFER (see trans_params_t),
+ * then include this file to define
+ *
+ *     static void TRANS_BLOCKED_NAME(int M, int N, int A[N][M],
+ *                                    int B[M][N] TRANS_BLOCKED_ARGS);
+ *
+ * trans.c instantiates it with the parameters as arguments for
+ * tune-trans, and trans-params.h once per tuned shape with them as
+ * constants, so the two run the same accesses. The function has the
+ * handout's 12 int locals and calls nothing, so it stays within them
+ * however it is reached. The macros are undefined again at the end.
+ */
+
+#include "trans-tune.h"
+
+/* Last row and column of the block at (r, c), and the row left from j */
+#define TRANS_REND (r + TRANS_BLOCK_H < N ? r + TRANS_BLOCK_H : N)
+#define TRANS_CEND (c + TRANS_BLOCK_W < M ? c + TRANS_BLOCK_W : M)
+#define TRANS_LEFT (TRANS_CEND - j)
+
+/* Elements of a row loaded at a time outside the 8x8 tiles of QUAD */
+#define TRANS_STEP (TRANS_BUFFER == TRANS_BUFFER_QUAD ? TRANS_BUFFER_MAX : TRANS_BUFFER)
+
+/* Whether element n of the chunk at j is in the block, and to be stored now */
+#define TRANS_HAS(n) (TRANS_STEP > (n) && TRANS_LEFT > (n))
+#define TRANS_STORE(n) (TRANS_HAS(n) && (!TRANS_DIAG || j + (n) != i))
+
+static void TRANS_BLOCKED_NAME(int M, int N, int A[N][M],
+                               int B[M][N] TRANS_BLOCKED_ARGS) {
+    int r, c, i, j;
+    int tmp0 = 0, tmp1 = 0, tmp2 = 0, tmp3 = 0, tmp4 = 0, tmp5 = 0, tmp6 = 0, tmp7 = 0;
+    for (r = 0, c = 0 ; TRANS_COL_MAJOR ? c < M : r < N ; ) {
+        if (TRANS_BUFFER == TRANS_BUFFER_QUAD &&
+            TRANS_REND - r == 8 && TRANS_CEND - c == 8) {
+            TRANS_QUAD_TILE(M, N, A, B, r, c);
+        } else {
+            /*
+             * A chunk of a row is loaded before any of it is stored. With
+             * TRANS_DIAG, the store to the diagonal of B, which shares a
+             * set with the row of A being read, waits for the row to end.
+             */
+            for (i = r ; i < TRANS_REND ; ++i) {
+                for (j = c ; j < TRANS_CEND ; j += TRANS_STEP) {
+                    tmp0 = A[i][j];
+                    if (TRANS_HAS(1)) tmp1 = A[i][j + 1];
+                    if (TRANS_HAS(2)) tmp2 = A[i][j + 2];
+                    if (TRANS_HAS(3)) tmp3 = A[i][j + 3];
+                    if (TRANS_HAS(4)) tmp4 = A[i][j + 4];
+                    if (TRANS_HAS(5)) tmp5 = A[i][j + 5];
+                    if (TRANS_HAS(6)) tmp6 = A[i][j + 6];
+                    if (TRANS_HAS(7)) tmp7 = A[i][j + 7];
+                    if (TRANS_STORE(0)) B[j][i] = tmp0;
+                    if (TRANS_STORE(1)) B[j + 1][i] = tmp1;
+                    if (TRANS_STORE(2)) B[j + 2][i] = tmp2;
+                    if (TRANS_STORE(3)) B[j + 3][i] = tmp3;
+                    if (TRANS_STORE(4)) B[j + 4][i] = tmp4;
+                    if (TRANS_STORE(5)) B[j + 5][i] = tmp5;
+                    if (TRANS_STORE(6)) B[j + 6][i] = tmp6;
+                    if (TRANS_STORE(7)) B[j + 7][i] = tmp7;
+                }
+                if (TRANS_DIAG && i >= c && i < TRANS_CEND) {
+                    B[i][i] = A[i][i];
+                }
+            }
+        }
+
+        /* On to the next block down the column or along the row */
+        if (TRANS_COL_MAJOR) {
+            r += TRANS_BLOCK_H;
+            if (r >= N) {
+                r = 0;
+                c += TRANS_BLOCK_W;
+            }
+        } else {
+            c += TRANS_BLOCK_W;
+            if (c >= M) {
+                c = 0;
+                r += TRANS_BLOCK_H;
+            }
+        }
+    }
+}
+
+#undef TRANS_REND
+#undef TRANS_CEND
+#undef TRANS_LEFT
+#undef TRANS_STEP
+#undef TRANS_HAS
+#undef TRANS_STORE
+#undef TRANS_BLOCKED_NAME
+#undef TRANS_BLOCKED_ARGS
+#undef TRANS_BLOCK_W
+#undef TRANS_BLOCK_H
+#undef TRANS_COL_MAJOR
+#undef TRANS_DIAG
+#undef TRANS_BUFFER
@@ -0,0 +1,64 @@
+/*
+ * trans-params.h - Generated by tune-trans; do not edit
+ *
+ * ./tune-trans -o trans-params.h 32x32 64x64 61x67
+ * Tuned for s=5, E=1, b=5 with lru replacement
+ */
+
+#ifndef TRANS_PARAMS_H
+#define TRANS_PARAMS_H
+
+#include "trans-tune.h"
+
+/* 32x32 - hits:1764 misses:284 evictions:252 */
+#define TRANS_BLOCKED_NAME trans_tuned_32x32
+#define TRANS_BLOCKED_ARGS
+#define TRANS_BLOCK_W 8
+#define TRANS_BLOCK_H 1
+#define TRANS_COL_MAJOR 1
+#define TRANS_DIAG 0
+#define TRANS_BUFFER 8
+#include "trans-blocked.h"
+
+/* 64x64 - hits:9024 misses:1216 evictions:1184 */
+#define TRANS_BLOCKED_NAME trans_tuned_64x64
+#define TRANS_BLOCKED_ARGS
+#define TRANS_BLOCK_W 8
+#define TRANS_BLOCK_H 8
+#define TRANS_COL_MAJOR 0
+#define TRANS_DIAG 0
+#define TRANS_BUFFER TRANS_BUFFER_QUAD
+#include "trans-blocked.h"
+
+/* 61x67 - hits:6445 misses:1729 evictions:1697 */
+#define TRANS_BLOCKED_NAME trans_tuned_61x67
+#define TRANS_BLOCKED_ARGS
+#define TRANS_BLOCK_W 16
+#define TRANS_BLOCK_H 1
+#define TRANS_COL_MAJOR 1
+#define TRANS_DIAG 0
+#define TRANS_BUFFER 8
+#include "trans-blocked.h"
+
+/*
+ * trans_tuned - Transpose A into B with the tuned blocking for M x N.
+ *     Returns 0, having done nothing, if the shape was not tuned.
+ */
+static int trans_tuned(int M, int N, int A[N][M], int B[M][N])
+{
+    if (M == 32 && N == 32) {
+        trans_tuned_32x32(M, N, A, B);
+        return 1;
+    }
+    if (M == 64 && N == 64) {
+        trans_tuned_64x64(M, N, A, B);
+        return 1;
+    }
+    if (M == 61 && N == 67) {
+        trans_tuned_61x67(M, N, A, B);
+        return 1;
+    }
+    return 0;
+}
+
+#endif /* TRANS_PARAMS_H */
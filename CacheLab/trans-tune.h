@@ -0,0 +1,87 @@
+/*
+ * trans-tune.h - Parameters of the tunable blocked transpose in trans.c
+ *
+ * tune-trans runs transpose_params() over a range of parameters on the
+ * simulated cache and writes the ones with the fewest misses for each
+ * matrix shape to trans-params.h as copies of trans-blocked.h with the
+ * parameters compiled in, which transpose_submit tries before its
+ * hand-written cases.
+ */
+
+#ifndef TRANS_TUNE_H
+#define TRANS_TUNE_H
+
+/* Largest number of elements of a row of A held in registers */
+#define TRANS_BUFFER_MAX 8
+
+/*
+ * Value of buffer that selects the 8x8 tile of the 64x64 case, which
+ * parks the upper right quarter of each tile in B. Tiles that are not
+ * 8x8 are buffered TRANS_BUFFER_MAX elements at a time instead.
+ */
+#define TRANS_BUFFER_QUAD 0
+
+/*
+ * TRANS_QUAD_TILE - Transpose the 8x8 tile at row r and column c of A
+ *     the QUAD way, with i and tmp0 to tmp7 as scratch: the right half
+ *     of the top rows of A goes to the upper right of B first and is
+ *     moved down while the bottom rows are filled in. Rows of B four
+ *     apart never have to be cached at once, which is what defeats an
+ *     8x8 tile when rows four apart share cache sets, as at 64x64.
+ */
+#define TRANS_QUAD_TILE(M, N, A, B, r, c)                               \
+    do {                                                                \
+        for (i = (r) ; i < (r) + 4 ; ++i) {                             \
+            tmp0 = A[i][(c)];                                           \
+            tmp1 = A[i][(c) + 1];                                       \
+            tmp2 = A[i][(c) + 2];                                       \
+            tmp3 = A[i][(c) + 3];                                       \
+            tmp4 = A[i][(c) + 4];                                       \
+            tmp5 = A[i][(c) + 5];                                       \
+            tmp6 = A[i][(c) + 6];                                       \
+            tmp7 = A[i][(c) + 7];                                       \
+            B[(c)][i] = tmp0;                                           \
+            B[(c) + 1][i] = tmp1;                                       \
+            B[(c) + 2][i] = tmp2;                                       \
+            B[(c) + 3][i] = tmp3;                                       \
+            B[(c)][i + 4] = tmp4;                                       \
+            B[(c) + 1][i + 4] = tmp5;                                   \
+            B[(c) + 2][i + 4] = tmp6;                                   \
+            B[(c) + 3][i + 4] = tmp7;                                   \
+        }                                                               \
+        for (i = (c) + 4 ; i < (c) + 8 ; ++i) {                         \
+            tmp0 = B[i - 4][(r) + 4];                                   \
+            tmp1 = B[i - 4][(r) + 5];                                   \
+            tmp2 = B[i - 4][(r) + 6];                                   \
+            tmp3 = B[i - 4][(r) + 7];                                   \
+                                                                        \
+            B[i - 4][(r) + 4] = A[(r) + 4][i - 4];                      \
+            B[i - 4][(r) + 5] = A[(r) + 5][i - 4];                      \
+            B[i - 4][(r) + 6] = A[(r) + 6][i - 4];                      \
+            B[i - 4][(r) + 7] = A[(r) + 7][i - 4];                      \
+                                                                        \
+            B[i][(r)] = tmp0;                                           \
+            B[i][(r) + 1] = tmp1;                                       \
+            B[i][(r) + 2] = tmp2;                                       \
+            B[i][(r) + 3] = tmp3;                                       \
+                                                                        \
+            B[i][(r) + 4] = A[(r) + 4][i];                              \
+            B[i][(r) + 5] = A[(r) + 5][i];                              \
+            B[i][(r) + 6] = A[(r) + 6][i];                              \
+            B[i][(r) + 7] = A[(r) + 7][i];                              \
+        }                                                               \
+    } while (0)
+
+typedef struct trans_params {
+    int block_w;    /* columns of A per block */
+    int block_h;    /* rows of A per block */
+    int col_major;  /* walk blocks down columns of A rather than along rows */
+    int diag;       /* store diagonal elements after the rest of their row */
+    int buffer;     /* elements of a row of A loaded before storing to B */
+} trans_params_t;
+
+/* transpose_params - Blocked transpose of A into B shaped by params */
+void transpose_params(int M, int N, int A[N][M], int B[M][N],
+                      const trans_params_t *params);
+
+#endif /* TRANS_TUNE_H */
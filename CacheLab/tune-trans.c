@@ -0,0 +1,296 @@
+/*
+ * tune-trans.c - Searches the parameters of transpose_params() (see
+ *     trans-tune.h) for the fewest misses on a simulated cache and
+ *     writes the winner for each matrix shape to trans-params.h.
+ *
+ * Each candidate runs on the instrumented build of trans.c with its
+ * accesses fed straight into the simulator of csim.c, as test-trans
+ * does. The counts exclude the handful of harness accesses test-trans
+ * adds around each call.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "cachelab.h"
+#include "csim.h"
+#include "instrument.h"
+#include "trans-tune.h"
+
+/* Maximum array dimension */
+#define MAXN 256
+
+/* Maximum number of shapes tuned in one run */
+#define MAX_SHAPES 32
+
+/* Defined in trans.c */
+extern int is_transpose(int M, int N, int A[N][M], int B[M][N]);
+
+/* Matrices, laid out as in test-trans */
+static int A[MAXN][MAXN];
+static int B[MAXN][MAXN];
+
+/* Block sizes tried along each dimension */
+static const int block_sizes[] = {1, 2, 4, 6, 8, 12, 16, 20, 24, 32};
+
+/* Register buffer depths tried, TRANS_BUFFER_QUAD included */
+static const int buffers[] = {1, 2, 4, 8, TRANS_BUFFER_QUAD};
+
+/* Cache geometry and policy under which candidates are compared */
+static unsigned int s = 5, E = 1, b = 5;
+static const CSim_Cache_Policy *policy = &csim_policies[CSIM_POLICY_TYPE_LRU];
+static int verbose = 0;
+
+/* The winning parameters for one shape */
+typedef struct {
+    int M, N;
+    trans_params_t params;
+    CSim_Cache_Result summary;
+} tuned_t;
+
+/* State of a simulation, handed to the instrumentation sink */
+typedef struct {
+    CSim_Cache* cache;
+    CSim_Cache_Result summary;
+} sim_state_t;
+
+/*
+ * sim_access - Instrumentation sink feeding the simulated cache
+ */
+static void sim_access(void* arg, char op, unsigned long long address,
+                       unsigned int size)
+{
+    sim_state_t* state = arg;
+    CSim_Access access;
+
+    access.type = op == 'L' ? CSIM_OPERATION_TYPE_LOAD :
+                  op == 'S' ? CSIM_OPERATION_TYPE_STORE :
+                  CSIM_OPERATION_TYPE_MODIFY;
+    access.address = address;
+    access.size = size;
+    access.next_use = CSIM_NEVER;
+    access.pc = 0;
+    access.thread = 0;
+    csim_access_cache(state->cache, &access, &state->summary, 0);
+}
+
+/*
+ * evaluate - Simulate transpose_params() for one candidate. Returns 0
+ *     if B does not come out as the transpose of A.
+ */
+static int evaluate(int M, int N, const trans_params_t *candidate,
+                    CSim_Cache_Result *summary)
+{
+    sim_state_t state;
+    /* Keep the parameters inside the stack window the hooks ignore */
+    trans_params_t params = *candidate;
+
+    state.cache = csim_construct_cache(s, E, b, policy);
+    memset(&state.summary, 0, sizeof(state.summary));
+    initMatrix(M, N, A, B);
+
+    instr_start(sim_access, &state, __builtin_frame_address(0));
+    transpose_params(M, N, A, B, &params);
+    instr_stop();
+
+    csim_deconstruct_cache(&state.cache);
+    *summary = state.summary;
+    return is_transpose(M, N, A, B);
+}
+
+/*
+ * better - Fewer misses win; ties go to fewer accesses
+ */
+static int better(const CSim_Cache_Result *x, const CSim_Cache_Result *y)
+{
+    if (x->miss != y->miss)
+        return x->miss < y->miss;
+    return x->hit + x->miss < y->hit + y->miss;
+}
+
+/*
+ * tune - Try every candidate for an M x N transpose and keep the best
+ */
+static void tune(tuned_t *tuned)
+{
+    int M = tuned->M, N = tuned->N;
+    int w, h, buf, col_major, diag, found = 0, tried = 0;
+    trans_params_t params;
+    CSim_Cache_Result summary;
+    const int nsizes = sizeof(block_sizes) / sizeof(block_sizes[0]);
+    const int nbuffers = sizeof(buffers) / sizeof(buffers[0]);
+
+    for (w = 0; w < nsizes; w++) {
+        for (h = 0; h < nsizes; h++) {
+            for (buf = 0; buf < nbuffers; buf++) {
+                params.block_w = block_sizes[w];
+                params.block_h = block_sizes[h];
+                params.buffer = buffers[buf];
+                if (params.buffer > params.block_w)
+                    continue;
+                if (params.buffer == TRANS_BUFFER_QUAD &&
+                    (params.block_w != 8 || params.block_h != 8))
+                    continue;
+                for (col_major = 0; col_major <= 1; col_major++) {
+                    for (diag = 0; diag <= 1; diag++) {
+                        params.col_major = col_major;
+                        params.diag = diag;
+                        tried++;
+                        if (!evaluate(M, N, &params, &summary)) {
+                            printf("Error: Candidate %dx%d buffer %d is not a transpose\n",
+                                   params.block_w, params.block_h, params.buffer);
+                            exit(1);
+                        }
+                        if (verbose)
+                            printf("  %2dx%-2d buffer:%d col_major:%d diag:%d hits:%d misses:%d\n",
+                                   params.block_w, params.block_h, params.buffer,
+                                   col_major, diag, summary.hit, summary.miss);
+                        if (!found || better(&summary, &tuned->summary)) {
+                            tuned->params = params;
+                            tuned->summary = summary;
+                            found = 1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("%dx%d: %d candidates, best %dx%d buffer:%d col_major:%d diag:%d "
+           "hits:%d misses:%d evictions:%d\n", M, N, tried,
+           tuned->params.block_w, tuned->params.block_h, tuned->params.buffer,
+           tuned->params.col_major, tuned->params.diag,
+           tuned->summary.hit, tuned->summary.miss, tuned->summary.evict);
+}
+
+/*
+ * write_header - Emit a transpose for each winner, instantiated from
+ *     trans-blocked.h with its parameters as constants, and
+ *     trans_tuned() dispatching to them, so that transpose_submit
+ *     reaches the tuned code with no parameters in memory.
+ */
+static void write_header(FILE *fp, int argc, char *argv[],
+                         const tuned_t *tuned, int count)
+{
+    int i;
+
+    fprintf(fp, "/*\n * trans-params.h - Generated by tune-trans; do not edit\n *\n *");
+    for (i = 0; i < argc; i++)
+        fprintf(fp, " %s", argv[i]);
+    fprintf(fp, "\n * Tuned for s=%u, E=%u, b=%u with %s replacement\n */\n\n",
+            s, E, b, policy->name);
+    fprintf(fp, "#ifndef TRANS_PARAMS_H\n#define TRANS_PARAMS_H\n\n");
+    fprintf(fp, "#include \"trans-tune.h\"\n\n");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "/* %dx%d - hits:%d misses:%d evictions:%d */\n",
+                tuned[i].M, tuned[i].N, tuned[i].summary.hit,
+                tuned[i].summary.miss, tuned[i].summary.evict);
+        fprintf(fp, "#define TRANS_BLOCKED_NAME trans_tuned_%dx%d\n",
+                tuned[i].M, tuned[i].N);
+        fprintf(fp, "#define TRANS_BLOCKED_ARGS\n");
+        fprintf(fp, "#define TRANS_BLOCK_W %d\n", tuned[i].params.block_w);
+        fprintf(fp, "#define TRANS_BLOCK_H %d\n", tuned[i].params.block_h);
+        fprintf(fp, "#define TRANS_COL_MAJOR %d\n", tuned[i].params.col_major);
+        fprintf(fp, "#define TRANS_DIAG %d\n", tuned[i].params.diag);
+        if (tuned[i].params.buffer == TRANS_BUFFER_QUAD)
+            fprintf(fp, "#define TRANS_BUFFER TRANS_BUFFER_QUAD\n");
+        else
+            fprintf(fp, "#define TRANS_BUFFER %d\n", tuned[i].params.buffer);
+        fprintf(fp, "#include \"trans-blocked.h\"\n\n");
+    }
+    fprintf(fp, "/*\n * trans_tuned - Transpose A into B with the tuned blocking for M x N.\n"
+            " *     Returns 0, having done nothing, if the shape was not tuned.\n */\n");
+    fprintf(fp, "static int trans_tuned(int M, int N, int A[N][M], int B[M][N])\n{\n");
+    for (i = 0; i < count; i++) {
+        fprintf(fp, "    if (M == %d && N == %d) {\n", tuned[i].M, tuned[i].N);
+        fprintf(fp, "        trans_tuned_%dx%d(M, N, A, B);\n", tuned[i].M, tuned[i].N);
+        fprintf(fp, "        return 1;\n    }\n");
+    }
+    fprintf(fp, "    return 0;\n}\n\n#endif /* TRANS_PARAMS_H */\n");
+}
+
+/*
+ * usage - Print usage info
+ */
+static void usage(char *argv[])
+{
+    printf("Usage: %s [-hv] [-s <s>] [-E <E>] [-b <b>] [-p <policy>] [-o <file>] <M>x<N>...\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h          Print this help message.\n");
+    printf("  -v          Print the misses of every candidate.\n");
+    printf("  -s <num>    Number of set index bits (default 5).\n");
+    printf("  -E <num>    Number of lines per set (default 1).\n");
+    printf("  -b <num>    Number of block offset bits (default 5).\n");
+    printf("  -p <name>   Replacement policy (default lru).\n");
+    printf("  -o <file>   Generated header (default trans-params.h).\n");
+    printf("Example: %s -o trans-params.h 32x32 64x64 61x67\n", argv[0]);
+}
+
+int main(int argc, char *argv[])
+{
+    char c;
+    int i, count = 0;
+    char *out_path = "trans-params.h";
+    tuned_t tuned[MAX_SHAPES];
+    FILE *out_fp;
+
+    while ((c = getopt(argc, argv, "hvs:E:b:p:o:")) != -1) {
+        switch (c) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 's':
+            s = atoi(optarg);
+            break;
+        case 'E':
+            E = atoi(optarg);
+            break;
+        case 'b':
+            b = atoi(optarg);
+            break;
+        case 'p':
+            if ((policy = csim_find_policy(optarg)) == NULL) {
+                printf("Error: Unknown policy %s\n", optarg);
+                exit(1);
+            }
+            if (policy->need_future) {
+                printf("Error: Policy %s needs the whole trace up front\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'o':
+            out_path = optarg;
+            break;
+        case 'h':
+            usage(argv);
+            exit(0);
+        default:
+            usage(argv);
+            exit(1);
+        }
+    }
+
+    if (optind == argc || argc - optind > MAX_SHAPES) {
+        printf("Error: Give between 1 and %d shapes\n", MAX_SHAPES);
+        usage(argv);
+        exit(1);
+    }
+
+    for (i = optind; i < argc; i++, count++) {
+        if (sscanf(argv[i], "%dx%d", &tuned[count].M, &tuned[count].N) != 2 ||
+            tuned[count].M <= 0 || tuned[count].N <= 0 ||
+            tuned[count].M > MAXN || tuned[count].N > MAXN) {
+            printf("Error: Bad shape %s (max %dx%d)\n", argv[i], MAXN, MAXN);
+            exit(1);
+        }
+        tune(&tuned[count]);
+    }
+
+    if ((out_fp = fopen(out_path, "w")) == NULL) {
+        printf("Error: Cannot open %s\n", out_path);
+        exit(1);
+    }
+    write_header(out_fp, argc, argv, tuned, count);
+    fclose(out_fp);
+    return 0;
+}
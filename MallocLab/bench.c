@@ -0,0 +1,155 @@
+/*
+ * bench.c - Statistically robust timing of a test function (see bench.h)
+ *
+ * Runs are timed with clock_gettime(CLOCK_MONOTONIC). A run is an
+ * outlier when it lies further than config->outlier times 1.4826 MAD
+ * from the median, which for normal noise is that many standard
+ * deviations; interrupts and migrations only ever make runs slower, so
+ * in practice this trims the slow tail. The confidence interval of the
+ * median comes from order statistics, so it assumes nothing about the
+ * shape of the noise.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include "bench.h"
+
+/* Stride of the reads that clear the cache */
+#define CLEAR_STRIDE 64
+
+static char *clear_buf = NULL;
+static int clear_size = 0;
+static volatile int sink = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void clear(int bytes)
+{
+    int i, x = sink;
+
+    if (bytes > clear_size) {
+        free(clear_buf);
+        if ((clear_buf = calloc(1, bytes)) == NULL) {
+            fprintf(stderr, "Fatal error. Out of memory clearing the cache\n");
+            exit(1);
+        }
+        clear_size = bytes;
+    }
+    for (i = 0; i < bytes; i += CLEAR_STRIDE)
+        x += clear_buf[i];
+    sink = x;
+}
+
+static int compare(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* median - Median of n > 0 sorted values */
+static double median(const double *v, int n)
+{
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+/* mad - Median absolute deviation of n values from m, using dev as scratch */
+static double mad(const double *v, int n, double m, double *dev)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        dev[i] = fabs(v[i] - m);
+    qsort(dev, n, sizeof(double), compare);
+    return median(dev, n);
+}
+
+void bench_defaults(bench_config_t *config)
+{
+    config->warmup = 2;
+    config->reps = 15;
+    config->outlier = 3.5;
+    config->clear_bytes = 0;
+}
+
+int bench_pin(int cpu)
+{
+    cpu_set_t cpus;
+
+    if (cpu < 0 && (cpu = sched_getcpu()) < 0)
+        return -1;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return sched_setaffinity(0, sizeof(cpus), &cpus) == 0 ? cpu : -1;
+}
+
+void bench_run(bench_funct f, void *arg, const bench_config_t *config,
+               bench_result_t *result)
+{
+    int reps = config->reps > 0 ? config->reps : 1;
+    double *times, *dev, start, m, limit, sum;
+    int i, n, lo, hi;
+
+    if ((times = malloc(2 * reps * sizeof(double))) == NULL) {
+        fprintf(stderr, "Fatal error. Out of memory for %d runs\n", reps);
+        exit(1);
+    }
+    dev = times + reps;
+
+    for (i = 0; i < config->warmup; i++)
+        f(arg);
+    for (i = 0; i < reps; i++) {
+        if (config->clear_bytes > 0)
+            clear(config->clear_bytes);
+        start = now();
+        f(arg);
+        times[i] = now() - start;
+    }
+    qsort(times, reps, sizeof(double), compare);
+
+    /* Drop the outliers; what is left stays sorted */
+    m = median(times, reps);
+    limit = config->outlier * 1.4826 * mad(times, reps, m, dev);
+    for (i = n = 0; i < reps; i++) {
+        if (fabs(times[i] - m) <= limit || limit == 0)
+            times[n++] = times[i];
+    }
+
+    result->samples = n;
+    result->outliers = reps - n;
+    result->median = median(times, n);
+    result->mad = mad(times, n, result->median, dev);
+    for (i = 0, sum = 0; i < n; i++)
+        sum += times[i];
+    result->mean = sum / n;
+    result->min = times[0];
+
+    /*
+     * The median lies between order statistics lo and hi (from 0) with
+     * 95% confidence, by the normal approximation to Binomial(n, 1/2)
+     */
+    lo = (int) floor(n / 2.0 - 1.96 * sqrt(n) / 2) - 1;
+    hi = (int) ceil(n / 2.0 + 1.96 * sqrt(n) / 2);
+    result->ci_low = times[lo < 0 ? 0 : lo];
+    result->ci_high = times[hi > n - 1 ? n - 1 : hi];
+    free(times);
+}
+
+void bench_json(FILE *fp, const bench_result_t *result, double scale)
+{
+    fprintf(fp, "\"samples\": %d, \"outliers\": %d, \"median\": %.6g, "
+            "\"mad\": %.6g, \"mean\": %.6g, \"min\": %.6g, "
+            "\"ci_low\": %.6g, \"ci_high\": %.6g",
+            result->samples, result->outliers, result->median * scale,
+            result->mad * scale, result->mean * scale, result->min * scale,
+            result->ci_low * scale, result->ci_high * scale);
+}
@@ -0,0 +1,61 @@
+/*
+ * bench.h - Statistically robust timing of a test function
+ *
+ * An alternative to the K-best scheme of fcyc.h, which returns its best
+ * sample whether or not the K best ever agreed: the function is run a
+ * few times untimed, then timed a fixed number of times, and the runs
+ * are summarised by their median and spread, with outliers dropped.
+ */
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+#include <stdio.h>
+
+typedef void (*bench_funct)(void *);
+
+typedef struct {
+    int warmup;         /* untimed runs first */
+    int reps;           /* timed runs */
+    double outlier;     /* drop runs further than this many scaled MADs from the median */
+    int clear_bytes;    /* bytes of a buffer read before each run to clear the cache, 0 for none */
+} bench_config_t;
+
+/* Seconds taken by the timed runs that were kept */
+typedef struct {
+    int samples;        /* runs kept */
+    int outliers;       /* runs dropped */
+    double median;
+    double mad;         /* median absolute deviation from the median */
+    double mean;
+    double min;
+    double ci_low;      /* 95% confidence interval of the median */
+    double ci_high;
+} bench_result_t;
+
+/*
+ * bench_defaults - 2 warmup runs, 15 timed runs, outliers beyond 3.5
+ *     scaled MADs, no cache clearing
+ */
+void bench_defaults(bench_config_t *config);
+
+/*
+ * bench_pin - Pin the calling thread, and threads it starts later, to
+ *     a CPU, the one it is running on if cpu < 0. Returns the CPU, or
+ *     -1 if it could not be pinned.
+ */
+int bench_pin(int cpu);
+
+/*
+ * bench_run - Time f(arg) as config says
+ */
+void bench_run(bench_funct f, void *arg, const bench_config_t *config,
+               bench_result_t *result);
+
+/*
+ * bench_json - Print the fields of result as JSON members, "median": ...
+ *     and so on, with every time multiplied by scale, for the caller to
+ *     put in an object of its own
+ */
+void bench_json(FILE *fp, const bench_result_t *result, double scale);
+
+#endif /* _BENCH_H_ */
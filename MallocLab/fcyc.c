@@ -8,7 +8,11 @@
  * the time in CPU cycles for a function f.
  */
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/times.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
 #include <stdio.h>
 
 #include "fcyc.h"
@@ -36,6 +40,18 @@ static int *cache_buf = NULL;
 static double *values = NULL;
 static int samplecount = 0;
 
+/* perf_event_open counters, -1 for events the machine lacks */
+static int counters = 0;
+static int counter_fds[FCYC_EVENTS];
+static double sample_counts[FCYC_EVENTS];
+static double best_counts[FCYC_EVENTS];
+
+/* value, time enabled and time running, as read from a counter */
+typedef struct {
+    unsigned long long value, enabled, running;
+} counter_value;
+static counter_value counter_starts[FCYC_EVENTS];
+
 /* for debugging only */
 #define KEEP_VALS 0
 #define KEEP_SAMPLES 0
@@ -97,6 +113,65 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/* 
+ * open_event - Open a counter of one event in this process
+ */
+static int open_event(unsigned type, unsigned long long config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static void read_event(int e, counter_value *v)
+{
+    if (read(counter_fds[e], v, sizeof(*v)) != sizeof(*v))
+	memset(v, 0, sizeof(*v));
+}
+
+/* 
+ * start_events - Note where each counter stands before a sample
+ */
+static void start_events()
+{
+    int e;
+    for (e = 0; e < FCYC_EVENTS; e++)
+	if (counter_fds[e] >= 0)
+	    read_event(e, &counter_starts[e]);
+}
+
+/* 
+ * stop_events - Counts since start_events, scaled up when the kernel
+ *     had to share the counters out between events
+ */
+static void stop_events()
+{
+    counter_value v;
+    double running;
+    int e;
+    for (e = 0; e < FCYC_EVENTS; e++) {
+	if (counter_fds[e] < 0) {
+	    sample_counts[e] = -1;
+	    continue;
+	}
+	read_event(e, &v);
+	sample_counts[e] = v.value - counter_starts[e].value;
+	running = v.running - counter_starts[e].running;
+	if (running > 0)
+	    sample_counts[e] *= (v.enabled - counter_starts[e].enabled) / running;
+    }
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -135,9 +210,15 @@ double fcyc(test_funct f, void *argp)
 	    double cyc;
 	    if (clear_cache)
 		clear();
+	    if (counters)
+		start_events();
 	    start_comp_counter();
 	    f(argp);
 	    cyc = get_comp_counter();
+	    if (counters)
+		stop_events();
+	    if (counters && (samplecount == 0 || cyc < values[0]))
+		memcpy(best_counts, sample_counts, sizeof(best_counts));
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     } else {
@@ -145,9 +226,15 @@ double fcyc(test_funct f, void *argp)
 	    double cyc;
 	    if (clear_cache)
 		clear();
+	    if (counters)
+		start_events();
 	    start_counter();
 	    f(argp);
 	    cyc = get_counter();
+	    if (counters)
+		stop_events();
+	    if (counters && (samplecount == 0 || cyc < values[0]))
+		memcpy(best_counts, sample_counts, sizeof(best_counts));
 	    add_sample(cyc);
 	} while (!has_converged() && samplecount < maxsamples);
     }
@@ -245,7 +332,44 @@ void set_fcyc_epsilon(double epsilon_arg)
     epsilon = epsilon_arg;
 }
 
+/* 
+ * set_fcyc_counters - When set, will count hardware events around
+ *     each sample
+ *     Default = 0
+ */
+int set_fcyc_counters(int counters_arg)
+{
+    int e, opened = 0;
 
+    for (e = 0; counters && e < FCYC_EVENTS; e++)
+	if (counter_fds[e] >= 0)
+	    close(counter_fds[e]);
+    counters = 0;
+    if (!counters_arg)
+	return 0;
 
+    counter_fds[FCYC_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    counter_fds[FCYC_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counter_fds[FCYC_L1D_MISSES] = open_event(PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D));
+    counter_fds[FCYC_LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counter_fds[FCYC_DTLB_MISSES] = open_event(PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB));
+    counter_fds[FCYC_BRANCH_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    for (e = 0; e < FCYC_EVENTS; e++) {
+	best_counts[e] = -1;
+	if (counter_fds[e] >= 0)
+	    opened++;
+    }
+    counters = opened > 0;
+    return opened;
+}
 
-
+/* 
+ * get_fcyc_counts - Event counts of the sample that the last fcyc
+ *     call returned
+ */
+void get_fcyc_counts(double counts[FCYC_EVENTS])
+{
+    int e;
+    for (e = 0; e < FCYC_EVENTS; e++)
+	counts[e] = counters ? best_counts[e] : -1;
+}
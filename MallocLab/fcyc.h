@@ -63,6 +63,28 @@ void set_fcyc_maxsamples(int maxsamples_arg);
  */
 void set_fcyc_epsilon(double epsilon_arg);
 
+/* Hardware events counted when set_fcyc_counters is on */
+enum {
+    FCYC_CYCLES,
+    FCYC_INSTRUCTIONS,
+    FCYC_L1D_MISSES,    /* L1 data cache read misses */
+    FCYC_LLC_MISSES,    /* last-level cache misses */
+    FCYC_DTLB_MISSES,   /* data TLB read misses */
+    FCYC_BRANCH_MISSES,
+    FCYC_EVENTS
+};
 
+/* 
+ * set_fcyc_counters - When set, will count the events above around
+ *     each sample with perf_event_open. Returns how many of them the
+ *     machine lets us count; with none, counting stays off.
+ *     Default = 0
+ */
+int set_fcyc_counters(int counters_arg);
 
+/* 
+ * get_fcyc_counts - Event counts of the sample that the last fcyc
+ *     call returned, negative for events that were not counted
+ */
+void get_fcyc_counts(double counts[FCYC_EVENTS]);
 
@@ -19,6 +19,8 @@
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "bench.h"
 #include "config.h"
 
 /**********************
@@ -82,6 +84,12 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* hardware event counts for one run of the trace (-c) */
+    double counts[FCYC_EVENTS];
+
+    /* half width of the 95% confidence interval of secs, in % (-r) */
+    double ci;
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
@@ -89,6 +97,10 @@ typedef struct {
  * Global variables
  *******************/
 int verbose = 0;        /* global flag for verbose output */
+static int count_events = 0; /* count hardware events (-c) */
+static bench_config_t robust; /* bench.h runner settings (-r, -w) */
+static int robust_reps = 0;   /* time traces with the runner if > 0 (-r) */
+static FILE *json = NULL;     /* one JSON line per trace goes here (-J) */
 static int errors = 0;  /* number of errs found when running student malloc */
 char msg[MAXLINE];      /* for whenever we need to compose an error message */
 
@@ -127,6 +139,11 @@ static void eval_mm_speed(void *ptr);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printcounts(int n, stats_t *stats);
+static void eval_counts(fsecs_test_funct f, speed_t *params, double *counts);
+static void json_string(FILE *fp, char *s);
+static double eval_secs(fsecs_test_funct f, speed_t *params, stats_t *stats,
+			char *allocator, char *tracename);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -155,10 +172,12 @@ int main(int argc, char **argv)
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
     int numcorrect;
     
+    bench_defaults(&robust);
+
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalcr:w:J:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +203,28 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'c': /* Count hardware events for each trace */
+            count_events = 1;
+            break;
+        case 'r': /* Median of this many runs instead of K-best */
+            if ((robust_reps = atoi(optarg)) <= 0) {
+		usage();
+		exit(1);
+	    }
+	    robust.reps = robust_reps;
+            break;
+        case 'w': /* Warmup runs before those */
+            if ((robust.warmup = atoi(optarg)) < 0) {
+		usage();
+		exit(1);
+	    }
+            break;
+        case 'J': /* Write each trace's results as a line of JSON */
+	    if (!strcmp(optarg, "-"))
+		json = stdout;
+	    else if ((json = fopen(optarg, "w")) == NULL)
+		unix_error("ERROR: can't open the -J file");
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -237,6 +278,12 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (count_events && set_fcyc_counters(1) == 0) {
+	printf("No hardware event counters, ignoring -c\n");
+	count_events = 0;
+    }
+    if (robust_reps > 0 && bench_pin(-1) < 0)
+	printf("Can't pin to a CPU, so runs may migrate\n");
 
     /*
      * Optionally run and evaluate the libc malloc package 
@@ -261,7 +308,11 @@ int main(int argc, char **argv)
 		speed_params.trace = trace;
 		if (verbose > 1)
 		    printf("and performance.\n");
-		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		libc_stats[i].secs = eval_secs(eval_libc_speed, &speed_params,
+					       &libc_stats[i], "libc",
+					       tracefiles[i]);
+		if (count_events)
+		    eval_counts(eval_libc_speed, &speed_params, libc_stats[i].counts);
 	    }
 	    free_trace(trace);
 	}
@@ -271,6 +322,10 @@ int main(int argc, char **argv)
 	    printf("\nResults for libc malloc:\n");
 	    printresults(num_tracefiles, libc_stats);
 	}
+	if (count_events) {
+	    printf("\nHardware events for libc malloc:\n");
+	    printcounts(num_tracefiles, libc_stats);
+	}
     }
 
     /*
@@ -302,7 +357,10 @@ int main(int argc, char **argv)
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    mm_stats[i].secs = eval_secs(eval_mm_speed, &speed_params,
+					 &mm_stats[i], "mm", tracefiles[i]);
+	    if (count_events)
+		eval_counts(eval_mm_speed, &speed_params, mm_stats[i].counts);
 	}
 	free_trace(trace);
     }
@@ -313,6 +371,11 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (count_events) {
+	printf("Hardware events for mm malloc:\n");
+	printcounts(num_tracefiles, mm_stats);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -926,17 +989,21 @@ static void printresults(int n, stats_t *stats)
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
+    printf("%5s%7s %5s%8s%10s%6s%s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops",
+	   robust_reps > 0 ? "  +/-CI" : "");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (robust_reps > 0)
+		printf("%6.1f%%", stats[i].ci);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
@@ -972,6 +1039,108 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * eval_counts - Hardware event counts of the fastest run of a trace,
+ *    taken by the fcyc package (which also did the timing if
+ *    USE_FCYC is set)
+ */
+static void eval_counts(fsecs_test_funct f, speed_t *params, double *counts)
+{
+#if !USE_FCYC
+    fcyc(f, params);
+#endif
+    get_fcyc_counts(counts);
+}
+
+/*
+ * json_string - Write s to fp as a JSON string, escaping quotes,
+ *    backslashes and control characters
+ */
+static void json_string(FILE *fp, char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char) *s < 0x20)
+	    fprintf(fp, "\\u%04x", (unsigned char) *s);
+	else
+	    fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * eval_secs - Seconds for one run of a trace: the K-best estimate of
+ *    fsecs, or with -r the median of the bench.h runner, with the half
+ *    width of its 95% confidence interval left in stats->ci. With -J
+ *    the measurement is also written out as a line of JSON.
+ */
+static double eval_secs(fsecs_test_funct f, speed_t *params, stats_t *stats,
+			char *allocator, char *tracename)
+{
+    bench_result_t r;
+    double secs;
+
+    if (robust_reps > 0) {
+	bench_run(f, params, &robust, &r);
+	secs = r.median;
+	stats->ci = 50.0 * (r.ci_high - r.ci_low) / r.median;
+    }
+    else
+	secs = fsecs(f, params);
+
+    if (json != NULL) {
+	fprintf(json, "{\"allocator\": ");
+	json_string(json, allocator);
+	fprintf(json, ", \"trace\": ");
+	json_string(json, tracename);
+	fprintf(json, ", \"ops\": %.0f, \"util\": %.4f, \"secs\": %.6g, \"kops\": %.6g",
+		stats->ops, stats->util, secs, stats->ops / 1e3 / secs);
+	if (robust_reps > 0) {
+	    fprintf(json, ", \"unit\": \"seconds\", ");
+	    bench_json(json, &r, 1.0);
+	}
+	fprintf(json, "}\n");
+	fflush(json);
+    }
+    return secs;
+}
+
+/*
+ * printcounts - prints the IPC and the misses per operation of some
+ *    malloc package on each trace
+ */
+static void printcounts(int n, stats_t *stats)
+{
+    int i, e;
+    static int events[] = {FCYC_L1D_MISSES, FCYC_LLC_MISSES,
+			   FCYC_DTLB_MISSES, FCYC_BRANCH_MISSES};
+
+    printf("%5s%7s%8s%8s%8s%8s\n",
+	   "trace", "IPC", "L1D/op", "LLC/op", "dTLB/op", "br/op");
+    for (i=0; i < n; i++) {
+	printf("%2d", i);
+	if (!stats[i].valid) {
+	    printf("%10s%8s%8s%8s%8s\n", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	if (stats[i].counts[FCYC_CYCLES] > 0 &&
+	    stats[i].counts[FCYC_INSTRUCTIONS] >= 0)
+	    printf("%10.2f", stats[i].counts[FCYC_INSTRUCTIONS] /
+		   stats[i].counts[FCYC_CYCLES]);
+	else
+	    printf("%10s", "-");
+	for (e = 0; e < 4; e++) {
+	    if (stats[i].counts[events[e]] >= 0)
+		printf("%8.2f", stats[i].counts[events[e]] / stats[i].ops);
+	    else
+		printf("%8s", "-");
+	}
+	printf("\n");
+    }
+}
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -1004,14 +1173,20 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValc] [-f <file>] [-t <dir>] [-r <reps>] [-w <runs>]\n"
+	    "               [-J <file>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-c         Count hardware events (IPC, misses per op) per trace.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-J <file>  Write each trace's results to <file> as a line of JSON.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-r <reps>  Pin to a CPU and time the median of <reps> runs,\n");
+    fprintf(stderr, "\t           outliers dropped, with its 95%% CI (see -v).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <runs>  Untimed warmup runs before -r's runs (default 2).\n");
 }
@@ -16,6 +16,7 @@
  ********************************************************************/
 
 #include <sys/time.h>
+#include <sys/mman.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -24,8 +25,14 @@
 #include <assert.h>
 #include <math.h>
 #include "fcyc.h"
+#include "clock.h"
 #include "defs.h"
 #include "config.h"
+#include "pool.h"
+#include "traffic.h"
+#include "bench.h"
+#include "stencil.h"
+#include "pipeline.h"
 
 /* Team structure that identifies the students */
 extern team_t team; 
@@ -38,6 +45,9 @@ extern team_t team;
 #define BSIZE 32     /* cache block size in bytes */     
 #define MAX_DIM 1280 /* 1024 + 256 */
 #define ODD_DIM 96   /* not a power of 2 */
+#define MAX_SIZES 16 /* most image sizes given with -D */
+#define MAX_SIZE 32768 /* largest of them, keeping RIDX within an int */
+#define HUGE_PAGE (2 << 20) /* bytes in a huge page */
 
 /* fast versions of min and max */
 #define min(a,b) (a < b ? a : b)
@@ -47,6 +57,8 @@ extern team_t team;
 typedef struct {
     lab_test_func tfunct; /* The test function */
     double cpes[DIM_CNT]; /* One CPE result for each dimension */
+    double counts[DIM_CNT][FCYC_EVENTS]; /* Event counts with -c */
+    double ci[DIM_CNT];   /* Half width of each CPE's 95% CI with -r, in % */
     char *description;    /* ASCII description of the test function */
     unsigned short valid; /* The function is tested if this is non zero */
 } bench_t;
@@ -75,6 +87,62 @@ static int smooth_benchmark_count = 0;
  */
 static pixel data[(3*MAX_DIM*MAX_DIM) + (BSIZE/sizeof(pixel))];
 
+/*
+ * With -D or -H each image size gets three images of its own in freshly
+ * mapped memory (on huge pages with -H) instead of data
+ */
+static int mapped_images = 0;
+static int huge_images = 0;
+static pixel *images = data;
+static size_t images_bytes = 0;
+static int images_dim = 0;
+
+/* Image sizes given with -D, tested in place of test_dim_rotate and test_dim_smooth */
+static int sizes[MAX_SIZES];
+static int size_cnt = 0;
+
+/* Print hardware event counts next to CPEs (-c) */
+static int count_events = 0;
+
+/* What traffic.h counts for the Bytes/pixel of -D sizes, NULL if nothing */
+static const char *traffic = NULL;
+
+/*
+ * With -r, CPEs are the median of that many runs of the bench.h runner
+ * instead of the K-best of fcyc, timed in seconds and turned into
+ * cycles at cycles_per_sec
+ */
+static bench_config_t robust;
+static int robust_reps = 0;
+static double cycles_per_sec = 0.0;
+
+/* With -J, one JSON object per measurement is written here */
+static FILE *json = NULL;
+
+/* Kernels with a weight total of 1, which the engine must not divide by */
+static const int identity_taps[] = {0, 1, 0};
+static const int identity_weights[] = {0, 0, 0, 0, 1, 0, 0, 0, 0};
+static const stencil_t identity_sep =
+    {1, NULL, identity_taps, identity_taps, STENCIL_RENORMALIZE};
+static const stencil_t identity_2d =
+    {1, identity_weights, NULL, NULL, STENCIL_ZERO};
+
+/* Kernels of the stencil engine (see stencil.h) that -S benchmarks */
+static struct {
+    const stencil_t *stencil;
+    char *description;
+} stencils[] = {
+    { &stencil_box3, "box3: 3x3 box as smooth, separable, renormalized edges" },
+    { &stencil_gauss5, "gauss5: 5x5 binomial Gaussian, clamped edges" },
+    { &stencil_blur7, "blur7: Separable 7x7 binomial blur, black edges" },
+    { &identity_sep, "identity_sep: Separable 3x3 identity, total 1" },
+    { &identity_2d, "identity_2d: 3x3 identity, total 1" }
+};
+static const stencil_t *current_stencil = NULL;
+
+/* The rotated image rotate() then smooth() pass through with -P */
+static pixel *between = NULL;
+
 /* Various image pointers */
 static pixel *orig = NULL;         /* original image */
 static pixel *copy_of_orig = NULL; /* copy of original for checking result */
@@ -116,6 +184,51 @@ static int random_in_interval(int low, int high)
     return (rand()% size) + low;
 }
 
+/*
+ * map_images - Map the memory for three dim x dim images, backed by huge
+ *     pages with -H when the system has them to give
+ */
+static void map_images(int dim)
+{
+    static int warned = 0;
+    size_t bytes = 3 * sizeof(pixel) * (size_t) dim * dim + BSIZE;
+    void *p = MAP_FAILED;
+
+    if (images_dim == dim)
+	return;
+    if (images_bytes > 0)
+	munmap(images, images_bytes);
+
+    bytes = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+#ifdef MAP_HUGETLB
+    if (huge_images)
+	p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (p == MAP_FAILED) {
+	p = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+	    printf("Can't map %lu bytes for %dx%d images\n",
+		   (unsigned long) bytes, dim, dim);
+	    exit(-5);
+	}
+	if (huge_images) {
+	    /* Fall back on transparent huge pages */
+#ifdef MADV_HUGEPAGE
+	    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+	    if (!warned) {
+		printf("No huge pages reserved, using transparent huge pages if enabled\n\n");
+		warned = 1;
+	    }
+	}
+    }
+    images = p;
+    images_bytes = bytes;
+    images_dim = dim;
+}
+
 /*
  * create - creates a dimxdim image aligned to a BSIZE byte boundary
  */
@@ -123,8 +236,11 @@ static void create(int dim)
 {
     int i, j;
 
+    if (mapped_images)
+	map_images(dim);
+
     /* Align the images to BSIZE byte boundaries */
-    orig = data;
+    orig = images;
     while ((unsigned)orig % BSIZE)
 	orig = (pixel *)((char *)orig) + 1;
     result = orig + dim*dim;
@@ -294,6 +410,163 @@ static int check_smooth(int dim) {
 }
 
 
+/*
+ * run_stencil - The stencil engine applying the kernel under test
+ */
+static void run_stencil(int dim, pixel *src, pixel *dst)
+{
+    stencil_apply(current_stencil, dim, src, dst);
+}
+
+/*
+ * check_stencil - Make sure the stencil engine gives what applying the
+ *     kernel under test a pixel at a time does
+ */
+static int check_stencil(int dim)
+{
+    int err = 0;
+    int i, j;
+    int badi = 0;
+    int badj = 0;
+    pixel right, wrong;
+    pixel *expected;
+
+    if (check_orig(dim))
+	return 1;
+    if ((expected = malloc(dim * dim * sizeof(pixel))) == NULL) {
+	printf("Out of memory checking dimension %d\n", dim);
+	return 1;
+    }
+    stencil_naive(current_stencil, dim, copy_of_orig, expected);
+
+    for (i = 0; i < dim; i++) {
+	for (j = 0; j < dim; j++) {
+	    if (compare_pixels(result[RIDX(i,j,dim)], expected[RIDX(i,j,dim)])) {
+		err++;
+		badi = i;
+		badj = j;
+		wrong = result[RIDX(i,j,dim)];
+		right = expected[RIDX(i,j,dim)];
+	    }
+	}
+    }
+    free(expected);
+
+    if (err) {
+	printf("\n");
+	printf("ERROR: Dimension=%d, %d errors\n", dim, err);
+	printf("E.g., \n");
+	printf("The engine has dst[%d][%d].{red,green,blue} = {%d,%d,%d}\n",
+	       badi, badj, wrong.red, wrong.green, wrong.blue);
+	printf("It should be dst[%d][%d].{red,green,blue} = {%d,%d,%d}\n",
+	       badi, badj, right.red, right.green, right.blue);
+    }
+
+    return err;
+}
+
+
+/*
+ * run_sequential - The pipeline rotate_smooth fuses, as rotate() into
+ *     an image in memory and smooth() from it
+ */
+static void run_sequential(int dim, pixel *src, pixel *dst)
+{
+    rotate(dim, src, between);
+    smooth(dim, between, dst);
+}
+
+/*
+ * check_pipeline - Make sure the result is smooth of the rotated
+ *     original image
+ */
+static int check_pipeline(int dim)
+{
+    int err = 0;
+    int i, j;
+    int badi = 0;
+    int badj = 0;
+    pixel right, wrong;
+    pixel *rotated;
+
+    if (check_orig(dim))
+	return 1;
+    if ((rotated = malloc(dim * dim * sizeof(pixel))) == NULL) {
+	printf("Out of memory checking dimension %d\n", dim);
+	return 1;
+    }
+    for (i = 0; i < dim; i++)
+	for (j = 0; j < dim; j++)
+	    rotated[RIDX(dim-1-j,i,dim)] = copy_of_orig[RIDX(i,j,dim)];
+
+    for (i = 0; i < dim; i++) {
+	for (j = 0; j < dim; j++) {
+	    pixel smoothed = check_average(dim, i, j, rotated);
+	    if (compare_pixels(result[RIDX(i,j,dim)], smoothed)) {
+		err++;
+		badi = i;
+		badj = j;
+		wrong = result[RIDX(i,j,dim)];
+		right = smoothed;
+	    }
+	}
+    }
+    free(rotated);
+
+    if (err) {
+	printf("\n");
+	printf("ERROR: Dimension=%d, %d errors\n", dim, err);
+	printf("E.g., \n");
+	printf("You have dst[%d][%d].{red,green,blue} = {%d,%d,%d}\n",
+	       badi, badj, wrong.red, wrong.green, wrong.blue);
+	printf("It should be dst[%d][%d].{red,green,blue} = {%d,%d,%d}\n",
+	       badi, badj, right.red, right.green, right.blue);
+    }
+
+    return err;
+}
+
+
+/*
+ * print_counts - With -c, print the IPC and the misses per pixel of a
+ *     function at each of n sizes, from its event counts
+ */
+static void print_counts(double counts[][FCYC_EVENTS], int *dims, int n)
+{
+    static const struct {
+	char *label;
+	int event;
+    } rows[] = {
+	{ "L1D miss/px", FCYC_L1D_MISSES },
+	{ "LLC miss/px", FCYC_LLC_MISSES },
+	{ "dTLB miss/px", FCYC_DTLB_MISSES },
+	{ "Br miss/px", FCYC_BRANCH_MISSES }
+    };
+    int i, k;
+
+    if (!count_events)
+	return;
+    printf("IPC\t");
+    for (i = 0; i < n; i++) {
+	if (counts[i][FCYC_CYCLES] > 0 && counts[i][FCYC_INSTRUCTIONS] >= 0)
+	    printf("\t%.2f", counts[i][FCYC_INSTRUCTIONS] / counts[i][FCYC_CYCLES]);
+	else
+	    printf("\t-");
+    }
+    printf("\n");
+    for (k = 0; k < sizeof(rows) / sizeof(rows[0]); k++) {
+	printf("%s", rows[k].label);
+	for (i = 0; i < n; i++) {
+	    if (counts[i][rows[k].event] >= 0)
+		printf("\t%.3f", counts[i][rows[k].event] / ((double) dims[i] * dims[i]));
+	    else
+		printf("\t-");
+	}
+	printf("\n");
+    }
+}
+
+
 void func_wrapper(void *arglist[]) 
 {
     pixel *src, *dst;
@@ -310,6 +583,92 @@ void func_wrapper(void *arglist[])
     return;
 }
 
+/*
+ * json_string - Write s to fp as a JSON string, escaping quotes,
+ *     backslashes and control characters
+ */
+static void json_string(FILE *fp, char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++) {
+	if (*s == '"' || *s == '\\')
+	    fprintf(fp, "\\%c", *s);
+	else if ((unsigned char) *s < 0x20)
+	    fprintf(fp, "\\u%04x", (unsigned char) *s);
+	else
+	    fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * measure - Return the CPE of bench's function on a fresh dim x dim
+ *     image, and fill counts with -c and *ci with -r unless they are
+ *     NULL. threads, if not 0, is the pool size given in the -J record.
+ */
+static double measure(char *kind, bench_t *bench, int dim, int threads,
+		      double *counts, double *ci)
+{
+    void *arglist[4];
+    double work = (double) dim * dim;
+    double cpe;
+    bench_result_t r;
+
+    arglist[0] = (void *) bench->tfunct;
+    arglist[1] = (void *) &dim;
+    arglist[2] = (void *) orig;
+    arglist[3] = (void *) result;
+
+    create(dim);
+    if (robust_reps > 0) {
+	bench_run((bench_funct) func_wrapper, arglist, &robust, &r);
+	cpe = r.median * cycles_per_sec / work;
+	if (ci != NULL)
+	    *ci = 50.0 * (r.ci_high - r.ci_low) / r.median;
+	/* The counts still come from fcyc, which samples around them */
+	if (count_events && counts != NULL)
+	    fcyc_v((test_funct_v)&func_wrapper, arglist);
+    }
+    else
+	cpe = fcyc_v((test_funct_v)&func_wrapper, arglist) / work;
+    if (counts != NULL)
+	get_fcyc_counts(counts);
+
+    if (json != NULL) {
+	fprintf(json, "{\"kernel\": ");
+	json_string(json, kind);
+	fprintf(json, ", \"version\": ");
+	json_string(json, bench->description);
+	fprintf(json, ", \"dim\": %d", dim);
+	if (threads > 0)
+	    fprintf(json, ", \"threads\": %d", threads);
+	fprintf(json, ", \"cpe\": %.6g", cpe);
+	if (robust_reps > 0) {
+	    fprintf(json, ", \"unit\": \"cycles/pixel\", ");
+	    bench_json(json, &r, cycles_per_sec / work);
+	}
+	fprintf(json, "}\n");
+	fflush(json);
+    }
+    return cpe;
+}
+
+/*
+ * print_ci - With -r, print the half width of each CPE's 95% confidence
+ *     interval, as a percentage of the CPE
+ */
+static void print_ci(double *ci, int n)
+{
+    int i;
+
+    if (robust_reps == 0)
+	return;
+    printf("95%% CI +/-");
+    for (i = 0; i < n; i++)
+	printf("\t%.1f%%", ci[i]);
+    printf("\n");
+}
+
 void run_rotate_benchmark(int idx, int dim) 
 {
     benchmarks_rotate[idx].tfunct(dim, orig, result);
@@ -350,24 +709,11 @@ void test_rotate(int bench_index)
 
 	/* Measure CPE */
 	{
-	    double num_cycles, cpe;
-	    int tmpdim = dim;
-	    void *arglist[4];
-	    double dimension = (double) dim;
-	    double work = dimension*dimension;
-#ifdef DEBUG
-	    printf("DEBUG: dimension=%.1f\n",dimension);
-	    printf("DEBUG: work=%.1f\n",work);
-#endif
-	    arglist[0] = (void *) benchmarks_rotate[bench_index].tfunct;
-	    arglist[1] = (void *) &tmpdim;
-	    arglist[2] = (void *) orig;
-	    arglist[3] = (void *) result;
+	    bench_t *bench = &benchmarks_rotate[bench_index];
 
-	    create(dim);
-	    num_cycles = fcyc_v((test_funct_v)&func_wrapper, arglist); 
-	    cpe = num_cycles/work;
-	    benchmarks_rotate[bench_index].cpes[test_num] = cpe;
+	    bench->cpes[test_num] = measure("Rotate", bench, dim, 0,
+					    bench->counts[test_num],
+					    &bench->ci[test_num]);
 	}
     }
 
@@ -385,6 +731,8 @@ void test_rotate(int bench_index)
 	printf("\t%.1f", benchmarks_rotate[bench_index].cpes[i]);
     }
     printf("\n");
+    print_ci(benchmarks_rotate[bench_index].ci, DIM_CNT);
+    print_counts(benchmarks_rotate[bench_index].counts, test_dim_rotate, DIM_CNT);
 
     printf("Baseline CPEs");
     for (i = 0; i < DIM_CNT; i++) {
@@ -467,24 +815,11 @@ void test_smooth(int bench_index)
 
 	/* Measure CPE */
 	{
-	    double num_cycles, cpe;
-	    int tmpdim = dim;
-	    void *arglist[4];
-	    double dimension = (double) dim;
-	    double work = dimension*dimension;
-#ifdef DEBUG
-	    printf("DEBUG: dimension=%.1f\n",dimension);
-	    printf("DEBUG: work=%.1f\n",work);
-#endif
-	    arglist[0] = (void *) benchmarks_smooth[bench_index].tfunct;
-	    arglist[1] = (void *) &tmpdim;
-	    arglist[2] = (void *) orig;
-	    arglist[3] = (void *) result;
-        
-	    create(dim);
-	    num_cycles = fcyc_v((test_funct_v)&func_wrapper, arglist); 
-	    cpe = num_cycles/work;
-	    benchmarks_smooth[bench_index].cpes[test_num] = cpe;
+	    bench_t *bench = &benchmarks_smooth[bench_index];
+
+	    bench->cpes[test_num] = measure("Smooth", bench, dim, 0,
+					    bench->counts[test_num],
+					    &bench->ci[test_num]);
 	}
     }
 
@@ -500,6 +835,8 @@ void test_smooth(int bench_index)
 	printf("\t%.1f", benchmarks_smooth[bench_index].cpes[i]);
     }
     printf("\n");
+    print_ci(benchmarks_smooth[bench_index].ci, DIM_CNT);
+    print_counts(benchmarks_smooth[bench_index].counts, test_dim_smooth, DIM_CNT);
 
     printf("Baseline CPEs");
     for (i = 0; i < DIM_CNT; i++) {
@@ -538,15 +875,238 @@ void test_smooth(int bench_index)
 }
 
 
+/*
+ * test_scaling - Print the CPEs of a function on 1 to max_threads
+ *     threads of the worker pool (see pool.h), doubling each time, and
+ *     their speedup over one thread
+ */
+void test_scaling(char *kind, bench_t *bench, int *test_dim, int dim_cnt,
+		  int (*check)(int), int max_threads)
+{
+    int i, threads;
+    double cpes[MAX_SIZES], base[MAX_SIZES];
+
+    printf("%s scaling: Version = %s:\n", kind, bench->description);
+    printf("Threads\t");
+    for (i = 0; i < dim_cnt; i++)
+	printf("\t%d", test_dim[i]);
+    printf("\tSpeedup\n");
+
+    for (threads = 1; ; threads = min(threads * 2, max_threads)) {
+	double prod = 1.0;
+
+	if (!pool_set_threads(threads)) {
+	    printf("Error: Cannot start %d threads\n", threads);
+	    break;
+	}
+	for (i = 0; i < dim_cnt; i++) {
+	    int dim = test_dim[i];
+
+	    create(dim);
+	    bench->tfunct(dim, orig, result);
+	    if (check(dim)) {
+		printf("Benchmark \"%s\" failed correctness check for dimension %d on %d threads.\n",
+		       bench->description, dim, threads);
+		return;
+	    }
+	    cpes[i] = measure(kind, bench, dim, threads, NULL, NULL);
+	    if (threads == 1)
+		base[i] = cpes[i];
+	    prod *= base[i] / cpes[i];
+	}
+	printf("%d\t", threads);
+	for (i = 0; i < dim_cnt; i++)
+	    printf("\t%.1f", cpes[i]);
+	printf("\t%.2f\n", pow(prod, 1.0/(double) dim_cnt));
+	if (threads == max_threads)
+	    break;
+    }
+    printf("\n");
+}
+
+
+/*
+ * test_sizes - Print the CPE of a function at each of n sizes, the
+ *     bandwidth that makes if it reads src once and writes dst once,
+ *     and, when there is a counter for it, the bytes it really moves
+ *     per pixel (2 * sizeof(pixel) at best)
+ */
+void test_sizes(char *kind, bench_t *bench, int *dims, int n,
+		int (*check)(int), double clock_mhz)
+{
+    int i;
+    double cpes[MAX_SIZES], bytes[MAX_SIZES], ci[MAX_SIZES];
+    double counts[MAX_SIZES][FCYC_EVENTS];
+
+    for (i = 0; i < n; i++) {
+	int dim = dims[i];
+
+	create(dim);
+	bench->tfunct(dim, orig, result);
+	if (check(dim)) {
+	    printf("Benchmark \"%s\" failed correctness check for dimension %d.\n",
+		   bench->description, dim);
+	    return;
+	}
+	cpes[i] = measure(kind, bench, dim, 0, counts[i], &ci[i]);
+	if (traffic != NULL) {
+	    create(dim);
+	    traffic_start();
+	    bench->tfunct(dim, orig, result);
+	    bytes[i] = traffic_bytes() / ((double) dim * dim);
+	}
+    }
+
+    printf("%s: Version = %s:\n", kind, bench->description);
+    printf("Dim\t");
+    for (i = 0; i < n; i++)
+	printf("\t%d", dims[i]);
+    printf("\n");
+    printf("Your CPEs");
+    for (i = 0; i < n; i++)
+	printf("\t%.1f", cpes[i]);
+    printf("\n");
+    print_ci(ci, n);
+    print_counts(counts, dims, n);
+    /* 2 * sizeof(pixel) bytes per pixel at clock_mhz * 1e6 cycles a second */
+    printf("GB/s\t");
+    for (i = 0; i < n; i++)
+	printf("\t%.2f", 2 * sizeof(pixel) * clock_mhz * 1e-3 / cpes[i]);
+    printf("\n");
+    if (traffic != NULL) {
+	printf("Bytes/pixel");
+	for (i = 0; i < n; i++)
+	    printf("\t%.1f", bytes[i]);
+	printf("\n");
+    }
+    printf("\n");
+}
+
+/*
+ * test_pipeline - Print the CPEs of rotate() then smooth() and of the
+ *     fused rotate_smooth() at each of n sizes, the speedup of fusing
+ *     them, and, when there is a counter for it, the bytes each moves
+ *     per pixel: the rotated image costs rotate then smooth at least
+ *     3 * sizeof(pixel) more than the 2 * sizeof(pixel) of rotate_smooth
+ */
+void test_pipeline(int *dims, int n)
+{
+    int i, k, biggest = 0;
+    bench_t benches[2];
+    double cpes[2][MAX_SIZES], bytes[2][MAX_SIZES];
+    double prod = 1.0;
+
+    benches[0].tfunct = run_sequential;
+    benches[0].description = "rotate() then smooth()";
+    benches[1].tfunct = rotate_smooth;
+    benches[1].description = rotate_smooth_descr;
+
+    for (i = 0; i < n; i++)
+	biggest = max(biggest, dims[i]);
+    if ((between = malloc((size_t) biggest * biggest * sizeof(pixel))) == NULL) {
+	printf("Error: Out of memory for the rotated image of dimension %d\n",
+	       biggest);
+	return;
+    }
+
+    for (i = 0; i < n; i++) {
+	int dim = dims[i];
+
+	for (k = 0; k < 2; k++) {
+	    create(dim);
+	    benches[k].tfunct(dim, orig, result);
+	    if (check_pipeline(dim)) {
+		printf("Benchmark \"%s\" failed correctness check for dimension %d.\n",
+		       benches[k].description, dim);
+		free(between);
+		return;
+	    }
+	    cpes[k][i] = measure("Pipeline", &benches[k], dim, 0, NULL, NULL);
+	    if (traffic != NULL) {
+		create(dim);
+		traffic_start();
+		benches[k].tfunct(dim, orig, result);
+		bytes[k][i] = traffic_bytes() / ((double) dim * dim);
+	    }
+	}
+	prod *= cpes[0][i] / cpes[1][i];
+    }
+    free(between);
+    between = NULL;
+
+    printf("Pipeline: Version = %s, against rotate() then smooth():\n",
+	   rotate_smooth_descr);
+    printf("Dim\t");
+    for (i = 0; i < n; i++)
+	printf("\t%d", dims[i]);
+    printf("\tMean\n");
+    printf("Sequential CPEs");
+    for (i = 0; i < n; i++)
+	printf("\t%.1f", cpes[0][i]);
+    printf("\n");
+    printf("Fused CPEs");
+    for (i = 0; i < n; i++)
+	printf("\t%.1f", cpes[1][i]);
+    printf("\n");
+    printf("Speedup\t");
+    for (i = 0; i < n; i++)
+	printf("\t%.2f", cpes[0][i] / cpes[1][i]);
+    printf("\t%.2f\n", pow(prod, 1.0/(double) n));
+    if (traffic != NULL) {
+	printf("Seq. Bytes/pixel");
+	for (i = 0; i < n; i++)
+	    printf("\t%.1f", bytes[0][i]);
+	printf("\n");
+	printf("Fused Bytes/pixel");
+	for (i = 0; i < n; i++)
+	    printf("\t%.1f", bytes[1][i]);
+	printf("\n");
+    }
+    printf("\n");
+}
+
+/*
+ * parse_sizes - Read the comma-separated image sizes of -D into sizes
+ */
+static int parse_sizes(char *list)
+{
+    char *token;
+
+    size_cnt = 0;
+    while ((token = strsep(&list, ",")) != NULL) {
+	if (size_cnt == MAX_SIZES || atoi(token) <= 0 || atoi(token) > MAX_SIZE)
+	    return 0;
+	sizes[size_cnt++] = atoi(token);
+    }
+    return size_cnt > 0;
+}
+
+
 void usage(char *progname) 
 {
-    fprintf(stderr, "Usage: %s [-hqg] [-f <func_file>] [-d <dump_file>]\n", progname);    
+    fprintf(stderr, "Usage: %s [-hqg] [-f <func_file>] [-d <dump_file>] [-p <threads>] [-D <dims>] [-H] [-c] [-S] [-P]\n"
+	    "       [-r <reps>] [-w <runs>] [-J <file>]\n", progname);    
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -h         Print this message\n");
     fprintf(stderr, "  -q         Quit after dumping (use with -d )\n");
     fprintf(stderr, "  -g         Autograder mode: checks only rotate() and smooth()\n");
     fprintf(stderr, "  -f <file>  Get test function names from dump file <file>\n");
     fprintf(stderr, "  -d <file>  Emit a dump file <file> for later use with -f\n");
+    fprintf(stderr, "  -p <n>     Give the parallel kernels <n> threads and report\n");
+    fprintf(stderr, "             CPE and speedup from 1 to <n> threads\n");
+    fprintf(stderr, "  -D <dims>  Test images of these sizes, e.g. 1024,4096,8192,\n");
+    fprintf(stderr, "             reporting CPE, GB/s and bytes moved per pixel\n");
+    fprintf(stderr, "  -H         Put the images on huge pages\n");
+    fprintf(stderr, "  -c         Count hardware events, printing IPC and misses\n");
+    fprintf(stderr, "             per pixel next to CPEs\n");
+    fprintf(stderr, "  -S         Also test the stencil engine's kernels against\n");
+    fprintf(stderr, "             stencil_naive at the smooth sizes, or at <dims>\n");
+    fprintf(stderr, "  -P         Compare rotate() then smooth() with the fused\n");
+    fprintf(stderr, "             rotate_smooth() at the rotate sizes, or at <dims>\n");
+    fprintf(stderr, "  -r <reps>  Pin to one CPU and report the median CPE of <reps>\n");
+    fprintf(stderr, "             runs, outliers dropped, and its 95%% CI\n");
+    fprintf(stderr, "  -w <runs>  Untimed warmup runs before those (default 2)\n");
+    fprintf(stderr, "  -J <file>  Write every measurement to <file> as a line of JSON\n");
     exit(EXIT_FAILURE);
 }
 
@@ -558,17 +1118,24 @@ int main(int argc, char *argv[])
     int quit_after_dump = 0;
     int skip_teamname_check = 0;
     int autograder = 0;
+    int max_threads = 0;
+    int test_stencils = 0;
+    int test_fused = 0;
+    double clock_mhz = 0.0;
     int seed = 1729;
     char c = '0';
     char *bench_func_file = NULL;
     char *func_dump_file = NULL;
 
+    bench_defaults(&robust);
+    robust.clear_bytes = 1 << 14; /* as fcyc clears below */
+
     /* register all the defined functions */
     register_rotate_functions();
     register_smooth_functions();
 
     /* parse command line args */
-    while ((c = getopt(argc, argv, "tgqf:d:s:h")) != -1)
+    while ((c = getopt(argc, argv, "tgqf:d:s:p:D:HcSPr:w:J:h")) != -1)
 	switch (c) {
 
 	case 't': /* skip team name check (hidden flag) */
@@ -612,6 +1179,66 @@ int main(int argc, char *argv[])
 	    }
 	    break;
 
+	case 'p': /* threads of the worker pool */
+	    max_threads = atoi(optarg);
+	    if (max_threads <= 0) {
+		printf("Thread count must be positive\n");
+		exit(-5);
+	    }
+	    break;
+
+	case 'D': /* image sizes */
+	    if (!parse_sizes(optarg)) {
+		printf("Sizes must be up to %d numbers from 1 to %d\n",
+		       MAX_SIZES, MAX_SIZE);
+		exit(-5);
+	    }
+	    mapped_images = 1;
+	    break;
+
+	case 'H': /* huge pages */
+	    huge_images = 1;
+	    mapped_images = 1;
+	    break;
+
+	case 'c': /* hardware event counts */
+	    count_events = 1;
+	    break;
+
+	case 'S': /* stencil engine kernels */
+	    test_stencils = 1;
+	    break;
+
+	case 'P': /* fused rotate and smooth pipeline */
+	    test_fused = 1;
+	    break;
+
+	case 'r': /* robust runner repetitions */
+	    robust_reps = atoi(optarg);
+	    if (robust_reps <= 0) {
+		printf("Repetitions must be positive\n");
+		exit(-5);
+	    }
+	    robust.reps = robust_reps;
+	    break;
+
+	case 'w': /* robust runner warmup runs */
+	    robust.warmup = atoi(optarg);
+	    if (robust.warmup < 0) {
+		printf("Warmup runs can't be negative\n");
+		exit(-5);
+	    }
+	    break;
+
+	case 'J': /* machine-readable results */
+	    if (strcmp(optarg, "-") == 0)
+		json = stdout;
+	    else if ((json = fopen(optarg, "w")) == NULL) {
+		printf("Can't open file %s\n", optarg);
+		exit(-5);
+	    }
+	    break;
+
 	case 'h': /* print help message */
 	    usage(argv[0]);
 
@@ -714,17 +1341,112 @@ int main(int argc, char *argv[])
     set_fcyc_cache_size(1 << 14); /* 16 KB cache size */
     set_fcyc_clear_cache(1); /* clear the cache before each measurement */
     set_fcyc_compensate(1); /* try to compensate for timer overhead */
+
+    /* Counters that follow the pool's threads must open before they start */
+    if (count_events) {
+	if (set_fcyc_counters(1) == 0) {
+	    printf("No hardware event counters, so no IPC or misses\n\n");
+	    count_events = 0;
+	}
+    }
+    if (size_cnt > 0) {
+	traffic = traffic_open();
+	if (traffic != NULL)
+	    printf("Bytes/pixel counts %s\n\n", traffic);
+	else
+	    printf("No counters of memory traffic, so no Bytes/pixel\n\n");
+    }
+
+    /*
+     * Pin to CPU 0, where the pool's worker 0 (the caller) belongs,
+     * and measure the clock once for the runner's seconds
+     */
+    if (robust_reps > 0) {
+	int cpu = bench_pin(0);
+
+	if (cpu < 0)
+	    cpu = bench_pin(-1);
+	if (cpu < 0)
+	    printf("Can't pin to a CPU, so runs may migrate\n");
+	else
+	    printf("Pinned to CPU %d\n", cpu);
+	cycles_per_sec = mhz(0) * 1e6;
+	printf("Median of %d runs after %d warmup runs, at %.1f MHz\n\n",
+	       robust.reps, robust.warmup, cycles_per_sec * 1e-6);
+    }
+
+    if (max_threads > 0 && !pool_set_threads(max_threads)) {
+	printf("Can't start %d threads\n", max_threads);
+	exit(-5);
+    }
  
-    for (i = 0; i < rotate_benchmark_count; i++) {
-	if (benchmarks_rotate[i].valid)
-	    test_rotate(i);
-    
-}
-    for (i = 0; i < smooth_benchmark_count; i++) {
-	if (benchmarks_smooth[i].valid)
-	    test_smooth(i);
+    if (size_cnt > 0 || test_stencils)
+	clock_mhz = cycles_per_sec > 0 ? cycles_per_sec * 1e-6 : mhz(0);
+
+    if (size_cnt > 0) {
+	for (i = 0; i < rotate_benchmark_count; i++) {
+	    if (benchmarks_rotate[i].valid)
+		test_sizes("Rotate", &benchmarks_rotate[i], sizes, size_cnt,
+			   check_rotate, clock_mhz);
+	}
+	for (i = 0; i < smooth_benchmark_count; i++) {
+	    if (benchmarks_smooth[i].valid)
+		test_sizes("Smooth", &benchmarks_smooth[i], sizes, size_cnt,
+			   check_smooth, clock_mhz);
+	}
+    }
+    else {
+	for (i = 0; i < rotate_benchmark_count; i++) {
+	    if (benchmarks_rotate[i].valid)
+		test_rotate(i);
+	}
+	for (i = 0; i < smooth_benchmark_count; i++) {
+	    if (benchmarks_smooth[i].valid)
+		test_smooth(i);
+	}
+    }
+
+
+    if (max_threads > 0) {
+	for (i = 0; i < rotate_benchmark_count; i++) {
+	    if (benchmarks_rotate[i].valid)
+		test_scaling("Rotate", &benchmarks_rotate[i],
+			     size_cnt > 0 ? sizes : test_dim_rotate,
+			     size_cnt > 0 ? size_cnt : DIM_CNT,
+			     check_rotate, max_threads);
+	}
+	for (i = 0; i < smooth_benchmark_count; i++) {
+	    if (benchmarks_smooth[i].valid)
+		test_scaling("Smooth", &benchmarks_smooth[i],
+			     size_cnt > 0 ? sizes : test_dim_smooth,
+			     size_cnt > 0 ? size_cnt : DIM_CNT,
+			     check_smooth, max_threads);
+	}
     }
 
+    /* The stencil engine's kernels, at the smooth sizes or the -D ones */
+    if (test_stencils) {
+	bench_t bench;
+
+	bench.tfunct = run_stencil;
+	for (i = 0; i < sizeof(stencils) / sizeof(stencils[0]); i++) {
+	    current_stencil = stencils[i].stencil;
+	    bench.description = stencils[i].description;
+	    test_sizes("Stencil", &bench,
+		       size_cnt > 0 ? sizes : test_dim_smooth,
+		       size_cnt > 0 ? size_cnt : DIM_CNT,
+		       check_stencil, clock_mhz);
+	}
+    }
+
+    /* The rotate and smooth pipeline, fused and not */
+    if (test_fused)
+	test_pipeline(size_cnt > 0 ? sizes : test_dim_rotate,
+		      size_cnt > 0 ? size_cnt : DIM_CNT);
+
+    /* There are no baselines to score -D sizes against */
+    if (size_cnt > 0)
+	return 0;
 
     if (autograder) {
 	printf("\nbestscores:%.1f:%.1f:\n", rotate_maxmean, smooth_maxmean);
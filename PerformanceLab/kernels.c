@@ -4,7 +4,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <immintrin.h>
 #include "defs.h"
+#include "pool.h"
+#include "stencil.h"
+#include "pipeline.h"
 
 /*
  * Please fill in the following team struct
@@ -75,6 +81,252 @@ void block_rotate(int dim, pixel * src, pixel * dst) {
     }
 }
 
+/*
+ * simd_rotate - Rotate 4x4 tiles of pixels in AVX2 registers. Each row
+ * of a tile (24 bytes) is loaded with every pixel widened to a 64-bit
+ * lane, the tile is transposed with 64-bit unpacks and 128-bit lane
+ * permutes, and each column comes out as a row of dst, packed back to
+ * 24 bytes. Tiles are walked down strips of ROTATE_STRIP columns of src,
+ * so that the ROTATE_STRIP rows of dst they fill are written from start
+ * to end. CPUs without AVX2 get block_rotate instead.
+ *
+ * When src and dst together outgrow the last-level cache, every line of
+ * dst would also be read for ownership before it is written, so dst is
+ * written with non-temporal stores instead: the tiles of ROTATE_BLOCK
+ * rows of a strip are rotated into a small staging image, and each row
+ * of it, ROTATE_BLOCK pixels of a row of dst, is streamed out with
+ * _mm_stream_si128. This needs dim a multiple of ROTATE_BLOCK and dst
+ * 16-byte aligned, so that the streamed rows are aligned.
+ */
+
+/* Columns of src, and so rows of dst, in each strip */
+#define ROTATE_STRIP 32
+
+/* Rows of src, and so pixels of each row of dst, staged at a time */
+#define ROTATE_BLOCK 32
+
+/* avx2_load4 - Load four pixels, each into the low 6 bytes of a 64-bit lane */
+__attribute__((target("avx2")))
+static inline __m256i avx2_load4(const pixel *p)
+{
+    const __m256i mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+    /* bytes 0-15 to the low half and 12-27 to the high half */
+    const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+    const __m256i widen = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1,
+                                           6, 7, 8, 9, 10, 11, -1, -1,
+                                           0, 1, 2, 3, 4, 5, -1, -1,
+                                           6, 7, 8, 9, 10, 11, -1, -1);
+    __m256i x = _mm256_maskload_epi32((const int *) p, mask);
+
+    return _mm256_shuffle_epi8(_mm256_permutevar8x32_epi32(x, spread), widen);
+}
+
+/* avx2_store4 - Store four pixels held as by avx2_load4 */
+__attribute__((target("avx2")))
+static inline void avx2_store4(pixel *p, __m256i x)
+{
+    const __m256i mask = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+    const __m256i narrow = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9,
+                                            10, 11, 12, 13, -1, -1, -1, -1,
+                                            0, 1, 2, 3, 4, 5, 8, 9,
+                                            10, 11, 12, 13, -1, -1, -1, -1);
+    const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+    _mm256_maskstore_epi32((int *) p, mask,
+        _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(x, narrow), gather));
+}
+
+/*
+ * avx2_rotate_tile - Rotate the 4x4 tile at in, whose rows are in_dim
+ *     pixels apart, to out, whose rows are out_dim apart: column k of
+ *     the tile becomes the row k rows above out
+ */
+__attribute__((target("avx2")))
+static inline void avx2_rotate_tile(const pixel *in, int in_dim,
+                                    pixel *out, int out_dim)
+{
+    __m256i r0 = avx2_load4(in);
+    __m256i r1 = avx2_load4(in + in_dim);
+    __m256i r2 = avx2_load4(in + 2 * in_dim);
+    __m256i r3 = avx2_load4(in + 3 * in_dim);
+    __m256i t0 = _mm256_unpacklo_epi64(r0, r1);
+    __m256i t1 = _mm256_unpackhi_epi64(r0, r1);
+    __m256i t2 = _mm256_unpacklo_epi64(r2, r3);
+    __m256i t3 = _mm256_unpackhi_epi64(r2, r3);
+
+    avx2_store4(out, _mm256_permute2x128_si256(t0, t2, 0x20));
+    avx2_store4(out - out_dim, _mm256_permute2x128_si256(t1, t3, 0x20));
+    avx2_store4(out - 2 * out_dim, _mm256_permute2x128_si256(t0, t2, 0x31));
+    avx2_store4(out - 3 * out_dim, _mm256_permute2x128_si256(t1, t3, 0x31));
+}
+
+/*
+ * avx2_rotate - simd_rotate of columns [j0, j1) of src on a CPU with
+ *     AVX2, j0 being a multiple of 4 and j1 one too unless it is dim
+ */
+__attribute__((target("avx2")))
+static void avx2_rotate(int dim, pixel *src, pixel *dst, int j0, int j1)
+{
+    int i, j, s, end;
+    int tiled = dim & ~3;
+    int last = j1 < tiled ? j1 : tiled;
+
+    for (s = j0; s < last; s += ROTATE_STRIP) {
+        end = s + ROTATE_STRIP < last ? s + ROTATE_STRIP : last;
+        for (i = 0; i < tiled; i += 4)
+            for (j = s; j < end; j += 4)
+                avx2_rotate_tile(src + RIDX(i, j, dim), dim,
+                                 dst + RIDX(dim-1-j, i, dim), dim);
+    }
+    /* Pixels past the last whole tile */
+    for (i = 0; i < dim; i++)
+        for (j = i < tiled && j0 < tiled ? tiled : j0; j < j1; j++)
+            dst[RIDX(dim-1-j, i, dim)] = src[RIDX(i, j, dim)];
+}
+
+/*
+ * avx2_stream_rotate - avx2_rotate with non-temporal stores to dst, for
+ *     can_stream images; j0 and j1 are multiples of 4
+ */
+__attribute__((target("avx2")))
+static void avx2_stream_rotate(int dim, pixel *src, pixel *dst, int j0, int j1)
+{
+    pixel stage[ROTATE_STRIP * ROTATE_BLOCK] __attribute__((aligned(32)));
+    int i0, i, j, s, w, q, k;
+
+    for (s = j0; s < j1; s += ROTATE_STRIP) {
+        w = j1 - s < ROTATE_STRIP ? j1 - s : ROTATE_STRIP;
+        for (i0 = 0; i0 < dim; i0 += ROTATE_BLOCK) {
+            /* Column j of the strip goes to row w - 1 - (j - s) of stage */
+            for (i = i0; i < i0 + ROTATE_BLOCK; i += 4)
+                for (j = s; j < s + w; j += 4)
+                    avx2_rotate_tile(src + RIDX(i, j, dim), dim,
+                                     stage + RIDX(w - 1 - (j - s), i - i0, ROTATE_BLOCK),
+                                     ROTATE_BLOCK);
+            /* Row q of stage is row dim - s - w + q of dst */
+            for (q = 0; q < w; q++) {
+                const __m128i *from = (const __m128i *) (stage + RIDX(q, 0, ROTATE_BLOCK));
+                __m128i *to = (__m128i *) (dst + RIDX(dim - s - w + q, i0, dim));
+
+                for (k = 0; k < ROTATE_BLOCK * (int) sizeof(pixel) / 16; k++)
+                    _mm_stream_si128(to + k, _mm_load_si128(from + k));
+            }
+        }
+    }
+    _mm_sfence();
+}
+
+/* can_stream - Whether avx2_stream_rotate can write this dst */
+static int can_stream(int dim, pixel *dst)
+{
+    return dim % ROTATE_BLOCK == 0 && ((unsigned long) dst & 15) == 0;
+}
+
+/* llc_bytes - Size of the last-level cache, or a guess at it */
+static long llc_bytes(void)
+{
+    long bytes = -1;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    bytes = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (bytes <= 0)
+        bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+    return bytes > 0 ? bytes : 8 << 20;
+}
+
+/* use_stream - Whether src and dst outgrow the cache and dst can be streamed */
+static int use_stream(int dim, pixel *dst)
+{
+    static long llc = 0;
+
+    if (llc == 0)
+        llc = llc_bytes();
+    return can_stream(dim, dst) && 2.0 * sizeof(pixel) * dim * dim > llc;
+}
+
+char simd_rotate_descr[] = "simd_rotate: AVX2 4x4 tile transposes";
+void simd_rotate(int dim, pixel *src, pixel *dst)
+{
+    if (!__builtin_cpu_supports("avx2"))
+        block_rotate(dim, src, dst);
+    else if (use_stream(dim, dst))
+        avx2_stream_rotate(dim, src, dst, 0, dim);
+    else
+        avx2_rotate(dim, src, dst, 0, dim);
+}
+
+/*
+ * stream_rotate - simd_rotate with non-temporal stores to dst at every
+ * size it can, for comparing the two
+ */
+char stream_rotate_descr[] = "stream_rotate: simd_rotate with non-temporal stores";
+void stream_rotate(int dim, pixel *src, pixel *dst)
+{
+    if (__builtin_cpu_supports("avx2") && can_stream(dim, dst))
+        avx2_stream_rotate(dim, src, dst, 0, dim);
+    else
+        simd_rotate(dim, src, dst);
+}
+
+/*
+ * The parallel kernels share an image out over the workers of pool.h in
+ * bands of rows (of dst for smooth, of src columns for rotate) whose
+ * edges are multiples of 4, and run the serial kernel below
+ * PARALLEL_MIN_DIM, where waking the workers costs more than it saves.
+ */
+#define PARALLEL_MIN_DIM 256
+
+typedef struct {
+    int dim;
+    pixel *src, *dst;
+    int stream;                 /* rotate with non-temporal stores */
+    int failed;                 /* set by a worker that ran out of memory */
+} image_job;
+
+/* band - Rows [*r0, *r1) of n that worker id of threads takes */
+static void band(int n, int id, int threads, int *r0, int *r1)
+{
+    int chunk = ((n + threads - 1) / threads + 3) & ~3;
+
+    *r0 = (long) id * chunk < n ? id * chunk : n;
+    *r1 = n - *r0 > chunk ? *r0 + chunk : n;
+}
+
+/*
+ * parallel_rotate - simd_rotate with each worker taking a band of
+ * columns of src, which is a band of rows of dst, so workers never
+ * write the same rows
+ */
+static void rotate_job(void *arg, int id, int threads)
+{
+    image_job *job = arg;
+    int j0, j1;
+
+    band(job->dim, id, threads, &j0, &j1);
+    if (j0 < j1 && job->stream)
+        avx2_stream_rotate(job->dim, job->src, job->dst, j0, j1);
+    else if (j0 < j1)
+        avx2_rotate(job->dim, job->src, job->dst, j0, j1);
+}
+
+char parallel_rotate_descr[] = "parallel_rotate: simd_rotate on the worker pool";
+void parallel_rotate(int dim, pixel *src, pixel *dst)
+{
+    image_job job;
+
+    if (dim < PARALLEL_MIN_DIM || pool_threads() == 1 ||
+        !__builtin_cpu_supports("avx2")) {
+        simd_rotate(dim, src, dst);
+        return;
+    }
+    job.dim = dim;
+    job.src = src;
+    job.dst = dst;
+    job.stream = use_stream(dim, dst);
+    pool_run(rotate_job, &job);
+}
+
 /*
  * rotate - Your current working version of rotate
  * IMPORTANT: This is the version you will be graded on
@@ -82,7 +334,7 @@ void block_rotate(int dim, pixel * src, pixel * dst) {
 char rotate_descr[] = "rotate: Current working version";
 void rotate(int dim, pixel *src, pixel *dst)
 {
-    block_rotate(dim, src, dst);
+    simd_rotate(dim, src, dst);
 }
 
 /*********************************************************************
@@ -100,6 +352,9 @@ void register_rotate_functions()
     /* ... Register additional test functions here */
     add_rotate_function(&code_motion_rotate, code_motion_rotate_descr);
     add_rotate_function(&block_rotate, block_rotate_descr);
+    add_rotate_function(&simd_rotate, simd_rotate_descr);
+    add_rotate_function(&stream_rotate, stream_rotate_descr);
+    add_rotate_function(&parallel_rotate, parallel_rotate_descr);
 }
 
 
@@ -250,6 +505,270 @@ void optimized_smooth(int dim, pixel * src, pixel * dst) {
     }
 }
 
+/*
+ * running_sum_smooth - Keep the sum of each column over the three rows
+ * around the current one, updated by adding the row entering the window
+ * and subtracting the row leaving it, then slide a three-column window
+ * along those sums. Each output pixel costs a few adds per channel, and
+ * the divisions by 9, 6 and 4 become multiplies by fixed-point
+ * reciprocals.
+ */
+
+/*
+ * RECIP_d is ceil(2^32 / d). (x * RECIP_d) >> 32 equals x / d whenever
+ * x * (RECIP_d * d - 2^32) < 2^32, which holds for any sum of nine
+ * channels (x < 2^20).
+ */
+#define RECIP_4 0x40000000u
+#define RECIP_6 0x2AAAAAABu
+#define RECIP_9 0x1C71C71Du
+#define RECIP_DIV(x, r) ((unsigned short) (((unsigned long long) (x) * (r)) >> 32))
+
+/*
+ * running_sum_row - Average one row of dst. Column sums are brought up
+ *     to date just ahead of the window, adding row enter and taking out
+ *     row leave; edge and inner are the reciprocals for the end pixels
+ *     of the row and for the others.
+ */
+static void running_sum_row(int dim, const pixel *enter, const pixel *leave,
+                            int *cr, int *cg, int *cb, pixel *dst,
+                            unsigned edge, unsigned inner)
+{
+    int j, r, g, b;
+
+    for (j = 0; j < 2; j++) {
+        cr[j] += enter[j].red - leave[j].red;
+        cg[j] += enter[j].green - leave[j].green;
+        cb[j] += enter[j].blue - leave[j].blue;
+    }
+    r = cr[0] + cr[1];
+    g = cg[0] + cg[1];
+    b = cb[0] + cb[1];
+    dst[0].red = RECIP_DIV(r, edge);
+    dst[0].green = RECIP_DIV(g, edge);
+    dst[0].blue = RECIP_DIV(b, edge);
+    for (j = 1; j < dim - 1; j++) {
+        cr[j + 1] += enter[j + 1].red - leave[j + 1].red;
+        cg[j + 1] += enter[j + 1].green - leave[j + 1].green;
+        cb[j + 1] += enter[j + 1].blue - leave[j + 1].blue;
+        r += cr[j + 1];
+        g += cg[j + 1];
+        b += cb[j + 1];
+        dst[j].red = RECIP_DIV(r, inner);
+        dst[j].green = RECIP_DIV(g, inner);
+        dst[j].blue = RECIP_DIV(b, inner);
+        r -= cr[j - 1];
+        g -= cg[j - 1];
+        b -= cb[j - 1];
+    }
+    dst[dim - 1].red = RECIP_DIV(r, edge);
+    dst[dim - 1].green = RECIP_DIV(g, edge);
+    dst[dim - 1].blue = RECIP_DIV(b, edge);
+}
+
+char running_sum_smooth_descr[] = "running_sum_smooth: Running column sums and a sliding window";
+void running_sum_smooth(int dim, pixel *src, pixel *dst)
+{
+    int i, j;
+    int *sums, *cr, *cg, *cb;
+    pixel *zero;
+
+    /* Column sums, then a row of black pixels standing in for rows off the image */
+    if (dim < 3 ||
+        (sums = calloc(1, 3 * dim * sizeof(int) + dim * sizeof(pixel))) == NULL) {
+        naive_smooth(dim, src, dst);
+        return;
+    }
+    cr = sums;
+    cg = sums + dim;
+    cb = sums + 2 * dim;
+    zero = (pixel *) (sums + 3 * dim);
+
+    for (j = 0; j < dim; j++) {
+        cr[j] = src[j].red;
+        cg[j] = src[j].green;
+        cb[j] = src[j].blue;
+    }
+    /* Top row sees rows 0 and 1 */
+    running_sum_row(dim, src + dim, zero, cr, cg, cb, dst, RECIP_4, RECIP_6);
+    /* Row i sees rows i - 1 to i + 1: row i + 1 enters and row i - 2 leaves */
+    running_sum_row(dim, src + RIDX(2, 0, dim), zero, cr, cg, cb,
+                    dst + dim, RECIP_6, RECIP_9);
+    for (i = 2; i < dim - 1; i++)
+        running_sum_row(dim, src + RIDX(i + 1, 0, dim), src + RIDX(i - 2, 0, dim),
+                        cr, cg, cb, dst + RIDX(i, 0, dim), RECIP_6, RECIP_9);
+    /* Bottom row sees rows dim - 2 and dim - 1 */
+    running_sum_row(dim, zero, src + RIDX(dim - 3, 0, dim), cr, cg, cb,
+                    dst + RIDX(dim - 1, 0, dim), RECIP_4, RECIP_6);
+    free(sums);
+}
+
+/*
+ * avx2_smooth - The 3x3 box filter with AVX2. A pixel is three unsigned
+ * shorts with no padding, so a row is an array of 3 * dim channels in
+ * which each channel's left and right neighbours sit 3 elements away.
+ * Both passes therefore work on the interleaved rows directly, with no
+ * transposing into planes: the rows of the window are summed into 32-bit
+ * lanes, then each lane adds the lanes 3 before and after it, is divided
+ * by a reciprocal multiply and packed back to 16 bits, 16 channels at a
+ * time. The end pixels of each row are done in scalar code. CPUs without
+ * AVX2 get running_sum_smooth instead.
+ */
+
+/* avx2_div - x / d in each of 8 lanes, recip holding RECIP_d */
+__attribute__((target("avx2")))
+static inline __m256i avx2_div(__m256i x, __m256i recip)
+{
+    __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(x, recip), 32);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), recip);
+
+    return _mm256_blend_epi32(even, odd, 0xAA);
+}
+
+/* avx2_column_sums - v = a + b + c over n channels, widened to ints */
+__attribute__((target("avx2")))
+static void avx2_column_sums(int n, const unsigned short *a,
+                             const unsigned short *b,
+                             const unsigned short *c, int *v)
+{
+    int k;
+
+    for (k = 0; k + 16 <= n; k += 16) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (a + k));
+        __m256i y = _mm256_loadu_si256((const __m256i *) (b + k));
+        __m256i z = _mm256_loadu_si256((const __m256i *) (c + k));
+        __m256i lo = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(x)),
+                             _mm256_cvtepu16_epi32(_mm256_castsi256_si128(y))),
+            _mm256_cvtepu16_epi32(_mm256_castsi256_si128(z)));
+        __m256i hi = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(x, 1)),
+                             _mm256_cvtepu16_epi32(_mm256_extracti128_si256(y, 1))),
+            _mm256_cvtepu16_epi32(_mm256_extracti128_si256(z, 1)));
+        _mm256_storeu_si256((__m256i *) (v + k), lo);
+        _mm256_storeu_si256((__m256i *) (v + k + 8), hi);
+    }
+    for (; k < n; k++)
+        v[k] = a[k] + b[k] + c[k];
+}
+
+/*
+ * avx2_row - Average one row of 3 * dim channels from the column sums,
+ *     edge and inner being the reciprocals for the end pixels and the
+ *     others
+ */
+__attribute__((target("avx2")))
+static void avx2_row(int dim, const int *v, unsigned short *out,
+                     unsigned edge, unsigned inner)
+{
+    int n = 3 * dim, k;
+    __m256i recip = _mm256_set1_epi32(inner);
+
+    for (k = 0; k < 3; k++) {
+        out[k] = RECIP_DIV(v[k] + v[k + 3], edge);
+        out[n - 3 + k] = RECIP_DIV(v[n - 6 + k] + v[n - 3 + k], edge);
+    }
+    for (k = 3; k + 16 <= n - 3; k += 16) {
+        __m256i lo = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (v + k - 3)),
+                             _mm256_loadu_si256((const __m256i *) (v + k))),
+            _mm256_loadu_si256((const __m256i *) (v + k + 3)));
+        __m256i hi = _mm256_add_epi32(
+            _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) (v + k + 5)),
+                             _mm256_loadu_si256((const __m256i *) (v + k + 8))),
+            _mm256_loadu_si256((const __m256i *) (v + k + 11)));
+        /* packus interleaves the 128-bit halves; put them back in order */
+        __m256i packed = _mm256_packus_epi32(avx2_div(lo, recip), avx2_div(hi, recip));
+        _mm256_storeu_si256((__m256i *) (out + k),
+                            _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    for (; k < n - 3; k++)
+        out[k] = RECIP_DIV(v[k - 3] + v[k] + v[k + 3], inner);
+}
+
+/*
+ * avx2_rows - avx2_smooth of rows [r0, r1) of dst for dim >= 3, reading
+ *     src rows r0 - 1 to r1; returns 0 if out of memory
+ */
+__attribute__((target("avx2")))
+static int avx2_rows(int dim, pixel *src, pixel *dst, int r0, int r1)
+{
+    int n = 3 * dim, i;
+    int *v;
+    unsigned short *zero;
+    const unsigned short *s = (const unsigned short *) src;
+    unsigned short *d = (unsigned short *) dst;
+
+    /* Column sums, then a black row standing in for rows off the image */
+    if ((v = calloc(1, n * sizeof(int) + n * sizeof(unsigned short))) == NULL)
+        return 0;
+    zero = (unsigned short *) (v + n);
+
+    for (i = r0; i < r1; i++) {
+        avx2_column_sums(n, i > 0 ? s + (i - 1) * n : zero, s + i * n,
+                         i < dim - 1 ? s + (i + 1) * n : zero, v);
+        if (i == 0 || i == dim - 1)
+            avx2_row(dim, v, d + i * n, RECIP_4, RECIP_6);
+        else
+            avx2_row(dim, v, d + i * n, RECIP_6, RECIP_9);
+    }
+    free(v);
+    return 1;
+}
+
+char avx2_smooth_descr[] = "avx2_smooth: AVX2 box filter on interleaved channels";
+void avx2_smooth(int dim, pixel *src, pixel *dst)
+{
+    if (dim < 3 || !__builtin_cpu_supports("avx2") ||
+        !avx2_rows(dim, src, dst, 0, dim))
+        running_sum_smooth(dim, src, dst);
+}
+
+/*
+ * parallel_smooth - avx2_smooth with each worker taking a band of rows
+ * of dst. The halo rows just outside a band are only read, from src, so
+ * the workers need not exchange them.
+ */
+static void smooth_job(void *arg, int id, int threads)
+{
+    image_job *job = arg;
+    int r0, r1;
+
+    band(job->dim, id, threads, &r0, &r1);
+    if (r0 < r1 && !avx2_rows(job->dim, job->src, job->dst, r0, r1))
+        job->failed = 1;
+}
+
+char parallel_smooth_descr[] = "parallel_smooth: avx2_smooth on the worker pool";
+void parallel_smooth(int dim, pixel *src, pixel *dst)
+{
+    image_job job;
+
+    if (dim < PARALLEL_MIN_DIM || pool_threads() == 1 ||
+        !__builtin_cpu_supports("avx2")) {
+        avx2_smooth(dim, src, dst);
+        return;
+    }
+    job.dim = dim;
+    job.src = src;
+    job.dst = dst;
+    job.failed = 0;
+    pool_run(smooth_job, &job);
+    if (job.failed)
+        running_sum_smooth(dim, src, dst);
+}
+
+/*
+ * stencil_smooth - smooth as the 3x3 box kernel of the stencil engine
+ * (see stencil.h): separable, so each row is summed across once and the
+ * sums are added down, and renormalized at the border as smooth is.
+ */
+char stencil_smooth_descr[] = "stencil_smooth: Separable box kernel on the stencil engine";
+void stencil_smooth(int dim, pixel *src, pixel *dst)
+{
+    stencil_apply(&stencil_box3, dim, src, dst);
+}
+
 /*
  * smooth - Your current working version of smooth.
  * IMPORTANT: This is the version you will be graded on
@@ -257,7 +776,7 @@ void optimized_smooth(int dim, pixel * src, pixel * dst) {
 char smooth_descr[] = "smooth: Current working version";
 void smooth(int dim, pixel *src, pixel *dst)
 {
-    optimized_smooth(dim, src, dst);
+    avx2_smooth(dim, src, dst);
 }
 
 
@@ -274,4 +793,135 @@ void register_smooth_functions() {
     add_smooth_function(&naive_smooth, naive_smooth_descr);
     /* ... Register additional test functions here */
     add_smooth_function(&optimized_smooth, optimized_smooth_descr);
+    add_smooth_function(&running_sum_smooth, running_sum_smooth_descr);
+    add_smooth_function(&avx2_smooth, avx2_smooth_descr);
+    add_smooth_function(&parallel_smooth, parallel_smooth_descr);
+    add_smooth_function(&stencil_smooth, stencil_smooth_descr);
+}
+
+
+/*****************************
+ * FUSED ROTATE AND SMOOTH
+ *****************************/
+
+/*
+ * rotate_smooth - smooth(rotate(src)) without the rotated image ever
+ * reaching memory. dst is made a band of rows at a time: the rows of the
+ * rotated image the band needs, the band itself and a halo row on either
+ * side, are rotated with the 4x4 tiles of simd_rotate into a buffer small
+ * enough to stay in cache and smoothed from there as avx2_smooth does.
+ * The halo is handed on rather than rotated again: the last two rows of
+ * one band's buffer are the first two of the next one's. So src is read
+ * once and dst written once, where rotate then smooth also writes the
+ * whole rotated image out and reads it back.
+ */
+
+/* band_bytes - Bytes of rotated rows a band may stage, a quarter of the L2 */
+static long band_bytes(void)
+{
+    static long bytes = 0;
+
+    if (bytes == 0) {
+        bytes = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        bytes = (bytes > 0 ? bytes : 1 << 20) / 4;
+    }
+    return bytes;
+}
+
+/* naive_rotate_smooth - rotate_smooth a pixel at a time, straight from src */
+static void naive_rotate_smooth(int dim, pixel *src, pixel *dst)
+{
+    int i, j, a, b;
+    pixel_sum sum;
+
+    /* Row a of the rotated image is column dim - 1 - a of src */
+    for (i = 0; i < dim; i++) {
+        for (j = 0; j < dim; j++) {
+            initialize_pixel_sum(&sum);
+            for (a = max(i - 1, 0); a <= min(i + 1, dim - 1); a++)
+                for (b = max(j - 1, 0); b <= min(j + 1, dim - 1); b++)
+                    accumulate_sum(&sum, src[RIDX(b, dim - 1 - a, dim)]);
+            assign_sum_to_pixel(&dst[RIDX(i, j, dim)], sum);
+        }
+    }
+}
+
+/*
+ * avx2_rotated_rows - Rows [a0, a1) of the rotated src to out, which
+ *     holds row a0 first; row a is column dim - 1 - a of src
+ */
+__attribute__((target("avx2")))
+static void avx2_rotated_rows(int dim, pixel *src, pixel *out, int a0, int a1)
+{
+    int j0 = dim - a1, j1 = dim - a0;
+    int tiled = dim & ~3;
+    int last = j0 + ((j1 - j0) & ~3);
+    int i, j;
+
+    for (i = 0; i < tiled; i += 4)
+        for (j = j0; j < last; j += 4)
+            avx2_rotate_tile(src + RIDX(i, j, dim), dim,
+                             out + RIDX(dim - 1 - j - a0, i, dim), dim);
+    /* Pixels past the last whole tile */
+    for (i = 0; i < dim; i++)
+        for (j = i < tiled ? last : j0; j < j1; j++)
+            out[RIDX(dim - 1 - j - a0, i, dim)] = src[RIDX(i, j, dim)];
+}
+
+/*
+ * avx2_rotate_smooth - rotate_smooth for dim >= 3 on a CPU with AVX2;
+ *     returns 0 if out of memory
+ */
+__attribute__((target("avx2")))
+static int avx2_rotate_smooth(int dim, pixel *src, pixel *dst)
+{
+    int n = 3 * dim, rows, r0, r1, i;
+    int *v;
+    unsigned short *zero, *buf, *mid;
+    unsigned short *d = (unsigned short *) dst;
+
+    /* Rows in a band: as many as fit band_bytes with the halo, in 4s */
+    rows = (int) (band_bytes() / (n * (long) sizeof(unsigned short)) - 2) & ~3;
+    rows = max(4, min(rows, (dim + 3) & ~3));
+
+    /* Column sums, a black row, then rows r0 - 1 to r0 + rows of the band */
+    if ((v = malloc(n * sizeof(int) +
+                    (rows + 3) * n * sizeof(unsigned short))) == NULL)
+        return 0;
+    zero = (unsigned short *) (v + n);
+    buf = zero + n;
+    memset(zero, 0, n * sizeof(unsigned short));
+
+    avx2_rotated_rows(dim, src, (pixel *) (buf + n), 0, min(rows + 1, dim));
+    for (r0 = 0; r0 < dim; r0 = r1) {
+        r1 = min(r0 + rows, dim);
+        for (i = r0; i < r1; i++) {
+            mid = buf + (i - r0 + 1) * n;
+            avx2_column_sums(n, i > 0 ? mid - n : zero, mid,
+                             i < dim - 1 ? mid + n : zero, v);
+            if (i == 0 || i == dim - 1)
+                avx2_row(dim, v, d + i * n, RECIP_4, RECIP_6);
+            else
+                avx2_row(dim, v, d + i * n, RECIP_6, RECIP_9);
+        }
+        /* Rows r1 - 1 and r1 are the next band's halo above and first row */
+        if (r1 < dim) {
+            memcpy(buf, buf + rows * n, 2 * n * sizeof(unsigned short));
+            avx2_rotated_rows(dim, src, (pixel *) (buf + 2 * n),
+                              r1 + 1, min(r1 + rows + 1, dim));
+        }
+    }
+    free(v);
+    return 1;
+}
+
+char rotate_smooth_descr[] = "rotate_smooth: Rotate bands into cache and smooth them there";
+void rotate_smooth(int dim, pixel *src, pixel *dst)
+{
+    if (dim < 3 || !__builtin_cpu_supports("avx2") ||
+        !avx2_rotate_smooth(dim, src, dst))
+        naive_rotate_smooth(dim, src, dst);
 }
@@ -0,0 +1,17 @@
+/*
+ * pipeline.h - The rotate then smooth pipeline as one kernel
+ */
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include "defs.h"
+
+/*
+ * rotate_smooth - dst = smooth(rotate(src)), without the rotated image
+ *     in between ever going out to memory
+ */
+void rotate_smooth(int dim, pixel *src, pixel *dst);
+
+extern char rotate_smooth_descr[];
+
+#endif /* _PIPELINE_H_ */
@@ -0,0 +1,54 @@
+/*
+ * pool-test.c - Check that the worker pool (see pool.h) runs every job
+ *     on every worker, including a job started as soon as the workers
+ *     are, before any of them has waited for one
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pool.h"
+
+/* Times to restart the pool and run a job on it straight away */
+#define ROUNDS 200
+
+/* Seconds after which a job that never finishes counts as a hang */
+#define TIMEOUT 20
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int ran[8];
+
+/* count - Note that worker id took its share */
+static void count(void *arg, int id, int threads)
+{
+    pthread_mutex_lock(&lock);
+    ran[id]++;
+    pthread_mutex_unlock(&lock);
+}
+
+int main(void)
+{
+    int round, threads, id;
+
+    alarm(TIMEOUT);
+    for (round = 0; round < ROUNDS; round++) {
+        /* Alternate sizes so that every round starts fresh workers */
+        threads = round % 2 ? 4 : 3;
+        if (!pool_set_threads(threads)) {
+            printf("FAIL: cannot start %d threads\n", threads);
+            return 1;
+        }
+        for (id = 0; id < threads; id++)
+            ran[id] = 0;
+        pool_run(count, NULL);
+        for (id = 0; id < threads; id++) {
+            if (ran[id] != 1) {
+                printf("FAIL: round %d, worker %d of %d ran %d times\n",
+                       round, id, threads, ran[id]);
+                return 1;
+            }
+        }
+    }
+    printf("PASS: %d jobs run right after pool_set_threads\n", ROUNDS);
+    return 0;
+}
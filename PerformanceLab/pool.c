@@ -0,0 +1,155 @@
+/*
+ * pool.c - Persistent pool of worker threads (see pool.h)
+ *
+ * There is one pool per process, started on first use. Workers are
+ * pinned to one CPU each so that the rows a kernel gives worker i on
+ * one call stay in that CPU's caches for the next.
+ */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pool.h"
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    unsigned long seen;         /* generation of the last job it took */
+} worker_t;
+
+static struct {
+    int threads;                /* 0 until the pool is started */
+    worker_t *workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    unsigned long generation;   /* bumped for every job */
+    int pending;                /* workers still busy with the job */
+    int stop;
+    /* current job */
+    pool_job_t job;
+    void *arg;
+} pool = {
+    0, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, 0, 0, 0, NULL, NULL
+};
+
+/*
+ * worker - Wait for each new job, do this worker's share and report back
+ */
+static void *worker(void *arg)
+{
+    worker_t *self = arg;
+    unsigned long seen = self->seen;
+    cpu_set_t cpus;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpu > 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(self->id % ncpu, &cpus);
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    }
+
+    /*
+     * seen was read when the worker was created, so a job that
+     * pool_run starts before the worker first gets here is not missed
+     */
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen && !pool.stop)
+            pthread_cond_wait(&pool.start, &pool.lock);
+        if (pool.stop)
+            break;
+        seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+
+        pool.job(pool.arg, self->id, pool.threads);
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+/*
+ * stop_workers - Join every worker but the caller
+ */
+static void stop_workers(void)
+{
+    int i;
+
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 1; i < pool.threads; i++)
+        pthread_join(pool.workers[i].thread, NULL);
+    pool.stop = 0;
+    pool.threads = 0;
+    free(pool.workers);
+    pool.workers = NULL;
+}
+
+int pool_set_threads(int threads)
+{
+    int i;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads == pool.threads)
+        return 1;
+    if (pool.threads > 0)
+        stop_workers();
+
+    pool.threads = 1;
+    if ((pool.workers = calloc(threads, sizeof(*pool.workers))) == NULL)
+        return 0;
+    for (i = 1; i < threads; i++) {
+        pool.workers[i].id = i;
+        pthread_mutex_lock(&pool.lock);
+        pool.workers[i].seen = pool.generation;
+        pthread_mutex_unlock(&pool.lock);
+        if (pthread_create(&pool.workers[i].thread, NULL, worker,
+                           &pool.workers[i]) != 0)
+            return 0;
+        pool.threads = i + 1;
+    }
+    return 1;
+}
+
+int pool_threads(void)
+{
+    long ncpu;
+
+    if (pool.threads == 0) {
+        ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        pool_set_threads(ncpu > 0 ? ncpu : 1);
+    }
+    return pool.threads;
+}
+
+void pool_run(pool_job_t job, void *arg)
+{
+    if (pool_threads() == 1) {
+        job(arg, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.job = job;
+    pool.arg = arg;
+    pool.pending = pool.threads - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+
+    job(arg, 0, pool.threads);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0)
+        pthread_cond_wait(&pool.done, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
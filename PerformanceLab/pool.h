@@ -0,0 +1,32 @@
+/*
+ * pool.h - Persistent pool of worker threads for the parallel kernels
+ *
+ * The workers are started once and then sleep between jobs, so a kernel
+ * can hand out its rows on every call without creating threads. The
+ * calling thread is worker 0 of every job.
+ */
+#ifndef _POOL_H_
+#define _POOL_H_
+
+/* A job: worker id of threads does its share of the work on arg */
+typedef void (*pool_job_t)(void *arg, int id, int threads);
+
+/*
+ * pool_set_threads - Run later jobs on the given number of workers.
+ *     Returns 0 if they could not all be started, leaving the pool
+ *     with as many as could.
+ */
+int pool_set_threads(int threads);
+
+/*
+ * pool_threads - Number of workers a job runs on, the online CPUs
+ *     unless pool_set_threads said otherwise
+ */
+int pool_threads(void);
+
+/*
+ * pool_run - Run job on every worker and wait for all of them
+ */
+void pool_run(pool_job_t job, void *arg);
+
+#endif /* _POOL_H_ */
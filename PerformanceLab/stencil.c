@@ -0,0 +1,514 @@
+/*
+ * stencil.c - A 2D stencil engine for images of pixels (see stencil.h)
+ *
+ * The work is done with AVX2 on the interleaved channels, as avx2_smooth
+ * in kernels.c does: a channel's left and right neighbours sit 3
+ * elements away, so a row is 3 * dim unsigned shorts, widened to 32-bit
+ * lanes and weighted 8 at a time. The image is cut into strips
+ * STENCIL_TILE pixels wide, each run from top to bottom so that the rows
+ * of the window stay in L1. A separable kernel sums across each row of a
+ * strip once, into a ring of 2 radius + 1 rows, then sums down the ring.
+ *
+ * The boundary is handled by padding rather than by testing each tap:
+ * a strip reads its rows through segments that reach radius pixels past
+ * each side, taken from src in place when they lie inside the image and
+ * otherwise copied out with the boundary's pixels filled in. Only under
+ * STENCIL_RENORMALIZE do the pixels of the border divide by totals of
+ * their own; the rows of the border get a divisor per row, and the
+ * columns of the border are divided one pixel at a time.
+ *
+ * The loops over the window are written once, in always_inline
+ * functions taking the radius, and SPECIALIZE instantiates them for
+ * radii 1 to 3 so that they unroll completely; other radii run the same
+ * code with the radius a variable.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "stencil.h"
+
+/* Pixels across a strip */
+#define STENCIL_TILE 128
+
+/* Most taps across and in a window */
+#define MAX_SPAN (2 * STENCIL_MAX_RADIUS + 1)
+#define MAX_TAPS (MAX_SPAN * MAX_SPAN)
+
+/* -O2 does not unroll loops by itself; UNROLL asks for the window loops */
+#define UNROLL _Pragma("GCC unroll 17")
+
+static const int ones3[] = {1, 1, 1};
+static const int binomial7[] = {1, 6, 15, 20, 15, 6, 1};
+static const int gauss5[] = {
+    1,  4,  6,  4, 1,
+    4, 16, 24, 16, 4,
+    6, 24, 36, 24, 6,
+    4, 16, 24, 16, 4,
+    1,  4,  6,  4, 1
+};
+
+const stencil_t stencil_box3 = {1, NULL, ones3, ones3, STENCIL_RENORMALIZE};
+const stencil_t stencil_gauss5 = {2, gauss5, NULL, NULL, STENCIL_CLAMP};
+const stencil_t stencil_blur7 = {3, NULL, binomial7, binomial7, STENCIL_ZERO};
+
+static inline int weight(const stencil_t *s, int a, int b)
+{
+    return s->weights != NULL ? s->weights[a * (2 * s->radius + 1) + b]
+                              : s->col[a] * s->row[b];
+}
+
+static inline int off_image(int dim, int i, int j)
+{
+    return i < 0 || i >= dim || j < 0 || j >= dim;
+}
+
+/*
+ * stencil_pixel - dst pixel (i, j), minding the boundary
+ */
+static void stencil_pixel(const stencil_t *s, int dim, int i, int j,
+                          const pixel *src, pixel *dst)
+{
+    int r = s->radius, a, b, ii, jj;
+    unsigned w, red = 0, green = 0, blue = 0, total = 0;
+    const pixel *p;
+    pixel *q = &dst[RIDX(i, j, dim)];
+
+    for (a = 0; a <= 2 * r; a++) {
+        for (b = 0; b <= 2 * r; b++) {
+            if ((w = weight(s, a, b)) == 0)
+                continue;
+            ii = i + a - r;
+            jj = j + b - r;
+            if (off_image(dim, ii, jj)) {
+                if (s->boundary == STENCIL_RENORMALIZE)
+                    continue;
+                if (s->boundary == STENCIL_ZERO) {
+                    total += w;
+                    continue;
+                }
+                ii = ii < 0 ? 0 : ii >= dim ? dim - 1 : ii;
+                jj = jj < 0 ? 0 : jj >= dim ? dim - 1 : jj;
+            }
+            p = &src[RIDX(ii, jj, dim)];
+            red += w * p->red;
+            green += w * p->green;
+            blue += w * p->blue;
+            total += w;
+        }
+    }
+    if (total == 0)
+        total = 1;
+    q->red = red / total;
+    q->green = green / total;
+    q->blue = blue / total;
+}
+
+void stencil_naive(const stencil_t *s, int dim, pixel *src, pixel *dst)
+{
+    int i, j;
+
+    for (i = 0; i < dim; i++)
+        for (j = 0; j < dim; j++)
+            stencil_pixel(s, dim, i, j, src, dst);
+}
+
+/*
+ * window_total - What pixel (i, j) divides its sum by, as stencil_pixel
+ */
+static unsigned window_total(const stencil_t *s, int dim, int i, int j)
+{
+    int r = s->radius, a0 = 0, a1 = 2 * r, b0 = 0, b1 = 2 * r, a, b;
+    unsigned total = 0;
+
+    if (s->boundary == STENCIL_RENORMALIZE) {
+        a0 = r - i > 0 ? r - i : 0;
+        a1 = dim - 1 - i + r < 2 * r ? dim - 1 - i + r : 2 * r;
+        b0 = r - j > 0 ? r - j : 0;
+        b1 = dim - 1 - j + r < 2 * r ? dim - 1 - j + r : 2 * r;
+    }
+    for (a = a0; a <= a1; a++)
+        for (b = b0; b <= b1; b++)
+            total += weight(s, a, b);
+    return total > 0 ? total : 1;
+}
+
+/*
+ * segment - The channels of columns [j0 - r, j1 + r) of row i, which
+ *     may lie off the image, with the boundary's pixels where they do;
+ *     read from src in place if they can be, else copied into buf.
+ *     zero is a black segment.
+ */
+static const unsigned short *segment(const stencil_t *s, int dim,
+                                     const unsigned short *src, int i,
+                                     int j0, int j1, unsigned short *buf,
+                                     const unsigned short *zero)
+{
+    int r = s->radius, lo = j0 - r, hi = j1 + r, jl, jh, j;
+    const unsigned short *row;
+    unsigned short *p;
+
+    if (i < 0 || i >= dim) {
+        if (s->boundary != STENCIL_CLAMP)
+            return zero;
+        i = i < 0 ? 0 : dim - 1;
+    }
+    row = src + 3 * i * dim;
+    if (lo >= 0 && hi <= dim)
+        return row + 3 * lo;
+
+    jl = lo > 0 ? lo : 0;
+    jh = hi < dim ? hi : dim;
+    memcpy(buf + 3 * (jl - lo), row + 3 * jl, 3 * (jh - jl) * sizeof(*buf));
+    for (j = lo; j < jl; j++) {
+        p = buf + 3 * (j - lo);
+        if (s->boundary == STENCIL_CLAMP)
+            memcpy(p, row, 3 * sizeof(*buf));
+        else
+            p[0] = p[1] = p[2] = 0;
+    }
+    for (j = jh; j < hi; j++) {
+        p = buf + 3 * (j - lo);
+        if (s->boundary == STENCIL_CLAMP)
+            memcpy(p, row + 3 * (dim - 1), 3 * sizeof(*buf));
+        else
+            p[0] = p[1] = p[2] = 0;
+    }
+    return buf;
+}
+
+/* Scratch space for one call of stencil_apply */
+typedef struct {
+    unsigned short *pad;    /* 2r + 1 segments copied out by segment */
+    unsigned short *zero;   /* a black segment */
+    int *ring;              /* separable: 2r + 1 rows of sums across ... */
+    int *zero_sums;         /* ... and one of zeros */
+    int seg_len;            /* channels in a segment, 3 (STENCIL_TILE + 2r) */
+} work_t;
+
+/*
+ * Division by the weight total in 8 lanes, by a reciprocal multiply. For
+ * totals below 256, recip is ceil(2^32 / total), which is exact for any
+ * sum of channels with those weights (see RECIP_DIV in kernels.c). For
+ * larger ones it is floor(2^32 / total), which leaves the quotient right
+ * or one short, and a compare of the remainder puts it right. A total
+ * of 1, whose reciprocal 2^32 does not fit, passes the sums through.
+ */
+#define EXACT_TOTAL 256
+
+typedef struct {
+    unsigned total;
+    __m256i recip;
+    __m256i totals;
+    __m256i below;      /* total - 1 */
+} divisor_t;
+
+__attribute__((target("avx2")))
+static inline void avx2_divisor(divisor_t *d, unsigned total)
+{
+    unsigned recip;
+
+    if (total == 1)
+        recip = 0;
+    else if (total < EXACT_TOTAL)
+        recip = (unsigned) ((0xFFFFFFFFULL + total) / total);
+    else
+        recip = (unsigned) (0x100000000ULL / total);
+    d->total = total;
+    d->recip = _mm256_set1_epi32(recip);
+    d->totals = _mm256_set1_epi32(total);
+    d->below = _mm256_set1_epi32(total - 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i avx2_divide(__m256i x, const divisor_t *d)
+{
+    __m256i even, odd, q, rem;
+
+    if (d->total == 1)
+        return x;
+    even = _mm256_srli_epi64(_mm256_mul_epu32(x, d->recip), 32);
+    odd = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), d->recip);
+    q = _mm256_blend_epi32(even, odd, 0xAA);
+    if (d->total < EXACT_TOTAL)
+        return q;
+    rem = _mm256_sub_epi32(x, _mm256_mullo_epi32(q, d->totals));
+    return _mm256_sub_epi32(q, _mm256_cmpgt_epi32(rem, d->below));
+}
+
+/* avx2_load8 - 8 channels from p, widened to ints */
+__attribute__((target("avx2")))
+static inline __m256i avx2_load8(const unsigned short *p)
+{
+    return _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) p));
+}
+
+/* avx2_store8 - 8 ints below 65536 to p as channels */
+__attribute__((target("avx2")))
+static inline void avx2_store8(unsigned short *p, __m256i x)
+{
+    _mm_storeu_si128((__m128i *) p,
+                     _mm_packus_epi32(_mm256_castsi256_si128(x),
+                                      _mm256_extracti128_si256(x, 1)));
+}
+
+/* avx2_madd - acc + w * x, skipping the multiply for weights of 1 */
+__attribute__((target("avx2")))
+static inline __m256i avx2_madd(__m256i acc, __m256i x, int w, __m256i wv)
+{
+    return _mm256_add_epi32(acc, w == 1 ? x : _mm256_mullo_epi32(x, wv));
+}
+
+/*
+ * row_divisor - Set d for the pixels of row i of a strip with columns
+ *     [j0, j1) that share one, and return in *k0 and *k1 the channels
+ *     of the strip they span; the rest divide by their own window_total
+ */
+static void row_divisor(const stencil_t *s, int dim, int i, int j0, int j1,
+                        divisor_t *d, int *k0, int *k1)
+{
+    int r = s->radius, c0 = j0, c1 = j1;
+    unsigned total;
+
+    if (s->boundary == STENCIL_RENORMALIZE) {
+        c0 = j0 > r ? j0 : r;
+        c1 = j1 < dim - r ? j1 : dim - r;
+        if (c1 < c0)
+            c1 = c0;
+    }
+    *k0 = 3 * (c0 - j0);
+    *k1 = 3 * (c1 - j0);
+    /* Outside STENCIL_RENORMALIZE there is one total for every pixel */
+    if (c0 < c1 && (d->total == 0 || s->boundary == STENCIL_RENORMALIZE) &&
+        (total = window_total(s, dim, i, c0)) != d->total)
+        avx2_divisor(d, total);
+}
+
+/*
+ * strip_2d - Columns [j0, j1) of dst for a kernel of radius r with full
+ *     weights
+ */
+__attribute__((target("avx2"), always_inline))
+static inline void strip_2d(int r, const stencil_t *s, int dim,
+                            const unsigned short *src, unsigned short *dst,
+                            int j0, int j1, work_t *work)
+{
+    int n = 3 * dim, span = 2 * r + 1, m = 3 * (j1 - j0), i, k, a, b, k0, k1;
+    int w[MAX_TAPS];
+    __m256i wv[MAX_TAPS];
+    const unsigned short *seg[MAX_SPAN], *p[MAX_SPAN];
+    unsigned total = 0, sum;
+    divisor_t d;
+
+    for (a = 0; a < span * span; a++) {
+        w[a] = s->weights[a];
+        wv[a] = _mm256_set1_epi32(w[a]);
+    }
+    d.total = 0;
+
+    /* Row i of the image lives in slot (i + r) % span */
+    for (i = -r; i < r; i++)
+        seg[i + r] = segment(s, dim, src, i, j0, j1,
+                             work->pad + (i + r) * work->seg_len, work->zero);
+
+    for (i = 0; i < dim; i++) {
+        unsigned short *out = dst + i * n + 3 * j0;
+
+        a = (i + 2 * r) % span;
+        seg[a] = segment(s, dim, src, i + r, j0, j1,
+                         work->pad + a * work->seg_len, work->zero);
+        UNROLL
+        for (a = 0; a < span; a++)
+            p[a] = seg[(i + a) % span];
+        row_divisor(s, dim, i, j0, j1, &d, &k0, &k1);
+
+        for (k = 0; k < m; k++) {
+            if (k == k0) {
+                for (; k + 8 <= k1; k += 8) {
+                    __m256i acc = _mm256_setzero_si256();
+
+                    UNROLL
+                    for (a = 0; a < span; a++)
+                        UNROLL
+                        for (b = 0; b < span; b++)
+                            if (w[a * span + b] != 0)
+                                acc = avx2_madd(acc, avx2_load8(p[a] + k + 3 * b),
+                                                w[a * span + b], wv[a * span + b]);
+                    avx2_store8(out + k, avx2_divide(acc, &d));
+                }
+                if (k == m)
+                    break;
+            }
+            if (k >= k0 && k < k1)
+                total = d.total;
+            else if (k % 3 == 0)
+                total = window_total(s, dim, i, j0 + k / 3);
+            sum = 0;
+            for (a = 0; a < span; a++)
+                for (b = 0; b < span; b++)
+                    sum += w[a * span + b] * p[a][k + 3 * b];
+            out[k] = sum / total;
+        }
+    }
+}
+
+/*
+ * strip_sep - strip_2d for a separable kernel
+ */
+__attribute__((target("avx2"), always_inline))
+static inline void strip_sep(int r, const stencil_t *s, int dim,
+                             const unsigned short *src, unsigned short *dst,
+                             int j0, int j1, work_t *work)
+{
+    int n = 3 * dim, span = 2 * r + 1, m = 3 * (j1 - j0), i, k, a, k0, k1;
+    int rw[MAX_SPAN], cw[MAX_SPAN];
+    __m256i rv[MAX_SPAN], cv[MAX_SPAN];
+    const int *slot[MAX_SPAN], *h[MAX_SPAN];
+    unsigned total = 0, sum;
+    divisor_t d;
+
+    for (a = 0; a < span; a++) {
+        rw[a] = s->row[a];
+        cw[a] = s->col[a];
+        rv[a] = _mm256_set1_epi32(rw[a]);
+        cv[a] = _mm256_set1_epi32(cw[a]);
+    }
+    d.total = 0;
+
+    /* Sums across row i of the image live in slot (i + r) % span */
+    for (i = -r; i < dim + r; i++) {
+        int o = i - r, *sums = work->ring + ((i + r) % span) * m;
+        const unsigned short *in;
+        unsigned short *out;
+
+        if ((i < 0 || i >= dim) && s->boundary != STENCIL_CLAMP)
+            slot[(i + r) % span] = work->zero_sums;
+        else {
+            in = segment(s, dim, src, i, j0, j1, work->pad, work->zero);
+            for (k = 0; k + 8 <= m; k += 8) {
+                __m256i acc = _mm256_setzero_si256();
+
+                UNROLL
+                for (a = 0; a < span; a++)
+                    if (rw[a] != 0)
+                        acc = avx2_madd(acc, avx2_load8(in + k + 3 * a), rw[a], rv[a]);
+                _mm256_storeu_si256((__m256i *) (sums + k), acc);
+            }
+            for (; k < m; k++) {
+                sum = 0;
+                for (a = 0; a < span; a++)
+                    sum += rw[a] * in[k + 3 * a];
+                sums[k] = sum;
+            }
+            slot[(i + r) % span] = sums;
+        }
+        if (o < 0)
+            continue;
+
+        /* Rows o - r to o + r are in the ring: sum down them */
+        UNROLL
+        for (a = 0; a < span; a++)
+            h[a] = slot[(o + a) % span];
+        row_divisor(s, dim, o, j0, j1, &d, &k0, &k1);
+        out = dst + o * n + 3 * j0;
+
+        for (k = 0; k < m; k++) {
+            if (k == k0) {
+                for (; k + 8 <= k1; k += 8) {
+                    __m256i acc = _mm256_setzero_si256();
+
+                    UNROLL
+                    for (a = 0; a < span; a++)
+                        if (cw[a] != 0)
+                            acc = avx2_madd(acc, _mm256_loadu_si256((const __m256i *) (h[a] + k)),
+                                            cw[a], cv[a]);
+                    avx2_store8(out + k, avx2_divide(acc, &d));
+                }
+                if (k == m)
+                    break;
+            }
+            if (k >= k0 && k < k1)
+                total = d.total;
+            else if (k % 3 == 0)
+                total = window_total(s, dim, o, j0 + k / 3);
+            sum = 0;
+            for (a = 0; a < span; a++)
+                sum += cw[a] * h[a][k];
+            out[k] = sum / total;
+        }
+    }
+}
+
+typedef void (*strip_t)(const stencil_t *, int, const unsigned short *,
+                        unsigned short *, int, int, work_t *);
+
+/* SPECIALIZE - strip_2d_r and strip_sep_r with the radius fixed at r */
+#define SPECIALIZE(r)                                                        \
+    __attribute__((target("avx2")))                                         \
+    static void strip_2d_##r(const stencil_t *s, int dim,                    \
+                             const unsigned short *src, unsigned short *dst, \
+                             int j0, int j1, work_t *work)                   \
+    {                                                                        \
+        strip_2d(r, s, dim, src, dst, j0, j1, work);                         \
+    }                                                                        \
+    __attribute__((target("avx2")))                                         \
+    static void strip_sep_##r(const stencil_t *s, int dim,                   \
+                              const unsigned short *src, unsigned short *dst,\
+                              int j0, int j1, work_t *work)                  \
+    {                                                                        \
+        strip_sep(r, s, dim, src, dst, j0, j1, work);                        \
+    }
+
+SPECIALIZE(1)
+SPECIALIZE(2)
+SPECIALIZE(3)
+
+__attribute__((target("avx2")))
+static void strip_2d_any(const stencil_t *s, int dim, const unsigned short *src,
+                         unsigned short *dst, int j0, int j1, work_t *work)
+{
+    strip_2d(s->radius, s, dim, src, dst, j0, j1, work);
+}
+
+__attribute__((target("avx2")))
+static void strip_sep_any(const stencil_t *s, int dim, const unsigned short *src,
+                          unsigned short *dst, int j0, int j1, work_t *work)
+{
+    strip_sep(s->radius, s, dim, src, dst, j0, j1, work);
+}
+
+static strip_t pick_strip(const stencil_t *s)
+{
+    static const strip_t full[] = {NULL, strip_2d_1, strip_2d_2, strip_2d_3};
+    static const strip_t separable[] = {NULL, strip_sep_1, strip_sep_2, strip_sep_3};
+
+    if (s->radius <= 3)
+        return s->weights != NULL ? full[s->radius] : separable[s->radius];
+    return s->weights != NULL ? strip_2d_any : strip_sep_any;
+}
+
+void stencil_apply(const stencil_t *s, int dim, pixel *src, pixel *dst)
+{
+    int span = 2 * s->radius + 1, j0, j1;
+    int sums = 3 * STENCIL_TILE;
+    work_t work;
+    void *mem;
+
+    work.seg_len = 3 * (STENCIL_TILE + 2 * s->radius);
+    if (!__builtin_cpu_supports("avx2") ||
+        (mem = calloc(1, (span + 1) * (sums * sizeof(int) +
+                                       work.seg_len * sizeof(short)))) == NULL) {
+        stencil_naive(s, dim, src, dst);
+        return;
+    }
+    work.ring = mem;
+    work.zero_sums = work.ring + span * sums;
+    work.pad = (unsigned short *) (work.zero_sums + sums);
+    work.zero = work.pad + span * work.seg_len;
+
+    for (j0 = 0; j0 < dim; j0 = j1) {
+        j1 = j0 + STENCIL_TILE < dim ? j0 + STENCIL_TILE : dim;
+        pick_strip(s)(s, dim, (const unsigned short *) src,
+                      (unsigned short *) dst, j0, j1, &work);
+    }
+    free(mem);
+}
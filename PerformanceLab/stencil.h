@@ -0,0 +1,53 @@
+/*
+ * stencil.h - A 2D stencil engine for images of pixels
+ *
+ * Each channel of a dst pixel is the weighted sum of the same channel
+ * over the (2 radius + 1) x (2 radius + 1) window of src around it,
+ * divided by the total of the weights and truncated, as smooth does.
+ */
+#ifndef _STENCIL_H_
+#define _STENCIL_H_
+
+#include "defs.h"
+
+/* Largest radius a stencil may have */
+#define STENCIL_MAX_RADIUS 8
+
+/* What happens where the window hangs off the image */
+typedef enum {
+    STENCIL_RENORMALIZE,    /* skip those taps and divide by the weights left, as smooth does */
+    STENCIL_CLAMP,          /* use the nearest pixel on the edge instead */
+    STENCIL_ZERO            /* use black instead */
+} stencil_boundary_t;
+
+/*
+ * A kernel. Weights are non-negative, with a positive total of at most
+ * 65535 so that sums fit in 32 bits. A separable kernel gives row and
+ * col, its weight at (a, b) being col[a] * row[b], and weights NULL.
+ */
+typedef struct {
+    int radius;                 /* 1 to STENCIL_MAX_RADIUS */
+    const int *weights;         /* (2 radius + 1)^2 weights, row by row */
+    const int *row;             /* 2 radius + 1 weights across ... */
+    const int *col;             /* ... and down, if separable */
+    stencil_boundary_t boundary;
+} stencil_t;
+
+/* Kernels that come with the engine */
+extern const stencil_t stencil_box3;    /* smooth: 3x3 box, renormalized */
+extern const stencil_t stencil_gauss5;  /* 5x5 binomial Gaussian, clamped */
+extern const stencil_t stencil_blur7;   /* separable 7-tap binomial blur, black edges */
+
+/*
+ * stencil_apply - Apply s to the dim x dim image src, giving dst, with
+ *     AVX2 code specialised for radii 1 to 3 where the CPU has it
+ */
+void stencil_apply(const stencil_t *s, int dim, pixel *src, pixel *dst);
+
+/*
+ * stencil_naive - stencil_apply one pixel at a time, the reference
+ *     the driver checks it against
+ */
+void stencil_naive(const stencil_t *s, int dim, pixel *src, pixel *dst);
+
+#endif /* _STENCIL_H_ */
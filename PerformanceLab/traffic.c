@@ -0,0 +1,182 @@
+/*
+ * traffic.c - Counts the bytes the kernels move to and from memory
+ *     (see traffic.h)
+ *
+ * The best counters are the CAS counts of the memory controllers
+ * (uncore_imc_N in sysfs, on Intel), which see every line read or
+ * written, write-backs and non-temporal stores included, but count the
+ * whole machine and need perf_event_paranoid <= 0. Failing those, the
+ * process's last-level cache load and store misses stand in for the
+ * lines read, which leaves out write-backs and non-temporal stores.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "traffic.h"
+
+/* Most counters open at once, two per memory controller per socket */
+#define MAX_COUNTERS 64
+
+/* Bytes per count, one line */
+#define LINE 64
+
+static int fds[MAX_COUNTERS];
+static unsigned long long starts[MAX_COUNTERS];
+static int counters = 0;
+
+static int open_counter(struct perf_event_attr *attr, int pid, int cpu)
+{
+    if (counters == MAX_COUNTERS)
+        return 0;
+    attr->size = sizeof(*attr);
+    fds[counters] = syscall(SYS_perf_event_open, attr, pid, cpu, -1, 0);
+    if (fds[counters] < 0)
+        return 0;
+    counters++;
+    return 1;
+}
+
+/*
+ * read_config - The config of an uncore event from its sysfs description,
+ *     e.g. "event=0x04,umask=0x03"; returns 0 if there is none
+ */
+static int read_config(const char *path, unsigned long long *config)
+{
+    FILE *fp = fopen(path, "r");
+    char line[128], *field;
+    unsigned long long value;
+
+    if (fp == NULL)
+        return 0;
+    if (fgets(line, sizeof(line), fp) == NULL) {
+        fclose(fp);
+        return 0;
+    }
+    fclose(fp);
+    *config = 0;
+    for (field = strtok(line, ",\n"); field != NULL; field = strtok(NULL, ",\n")) {
+        if (sscanf(field, "event=%llx", &value) == 1)
+            *config |= value;
+        else if (sscanf(field, "umask=%llx", &value) == 1)
+            *config |= value << 8;
+    }
+    return 1;
+}
+
+/*
+ * open_imc - Count CAS reads and writes on every memory controller;
+ *     returns 0 unless all of them could be counted
+ */
+static int open_imc(void)
+{
+    char dir[96], path[128], line[128], *field;
+    const char *events[2] = { "cas_count_read", "cas_count_write" };
+    struct perf_event_attr attr;
+    FILE *fp;
+    int imc, type, e, cpus[MAX_COUNTERS], ncpus, k;
+
+    for (imc = 0; ; imc++) {
+        sprintf(dir, "/sys/bus/event_source/devices/uncore_imc_%d", imc);
+        sprintf(path, "%s/type", dir);
+        if ((fp = fopen(path, "r")) == NULL)
+            break;
+        if (fscanf(fp, "%d", &type) != 1)
+            type = -1;
+        fclose(fp);
+
+        /* One CPU of each socket, which the counts are read on */
+        sprintf(path, "%s/cpumask", dir);
+        if (type < 0 || (fp = fopen(path, "r")) == NULL)
+            return 0;
+        ncpus = 0;
+        if (fgets(line, sizeof(line), fp) != NULL) {
+            for (field = strtok(line, ",\n"); field != NULL && ncpus < MAX_COUNTERS;
+                 field = strtok(NULL, ",\n"))
+                cpus[ncpus++] = atoi(field);
+        }
+        fclose(fp);
+
+        for (e = 0; e < 2; e++) {
+            memset(&attr, 0, sizeof(attr));
+            attr.type = type;
+            sprintf(path, "%s/events/%s", dir, events[e]);
+            if (!read_config(path, &attr.config))
+                return 0;
+            for (k = 0; k < ncpus; k++) {
+                if (!open_counter(&attr, -1, cpus[k]))
+                    return 0;
+            }
+        }
+    }
+    return counters > 0;
+}
+
+/*
+ * open_llc - Count this process's last-level cache load and store
+ *     misses, in threads started later too
+ */
+static int open_llc(void)
+{
+    struct perf_event_attr attr;
+    int op;
+
+    for (op = 0; op < 2; op++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL |
+            ((op ? PERF_COUNT_HW_CACHE_OP_WRITE : PERF_COUNT_HW_CACHE_OP_READ) << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        if (!open_counter(&attr, 0, -1))
+            return 0;
+    }
+    return 1;
+}
+
+static void close_counters(void)
+{
+    while (counters > 0)
+        close(fds[--counters]);
+}
+
+const char *traffic_open(void)
+{
+    if (open_imc())
+        return "memory controller reads and writes";
+    close_counters();
+    if (open_llc())
+        return "last-level cache misses (no write-backs or non-temporal stores)";
+    close_counters();
+    return NULL;
+}
+
+static unsigned long long count(int i)
+{
+    unsigned long long value;
+
+    if (read(fds[i], &value, sizeof(value)) != sizeof(value))
+        return 0;
+    return value;
+}
+
+void traffic_start(void)
+{
+    int i;
+
+    for (i = 0; i < counters; i++)
+        starts[i] = count(i);
+}
+
+double traffic_bytes(void)
+{
+    double lines = 0;
+    int i;
+
+    for (i = 0; i < counters; i++)
+        lines += count(i) - starts[i];
+    return lines * LINE;
+}
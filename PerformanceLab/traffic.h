@@ -0,0 +1,19 @@
+/*
+ * traffic.h - Counts the bytes the kernels move to and from memory
+ */
+#ifndef _TRAFFIC_H_
+#define _TRAFFIC_H_
+
+/*
+ * traffic_open - Find a counter of memory traffic, before any threads
+ *     are started. Returns what it counts, or NULL if there is none.
+ */
+const char *traffic_open(void);
+
+/* traffic_start - Start counting from zero */
+void traffic_start(void);
+
+/* traffic_bytes - Bytes moved since traffic_start */
+double traffic_bytes(void);
+
+#endif /* _TRAFFIC_H_ */